@@ -26,7 +26,18 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <list>
+#include <unordered_map>
 #include <set>
+#include <memory>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
+#include <cmath>
 #include <algorithm>
 #include <functional>
 #include <stdexcept>
@@ -37,13 +48,41 @@
 
 namespace sbn
 {
-	/// Possible inference methods. Only MCMC has been implemented so far.
+	/// Possible inference methods. Exact inference uses variable elimination,
+	/// the junction tree mode is also exact but calibrates all marginals at
+	/// once.  The other three are sampling methods.
 	enum { INFERENCE_MODE_EXACT,
 	       INFERENCE_MODE_REJECTION_SAMPLING,
 	       INFERENCE_MODE_LIKELIHOOD_WEIGHTING,
-	       INFERENCE_MODE_MARKOV_CHAIN_MONTE_CARLO };
+	       INFERENCE_MODE_MARKOV_CHAIN_MONTE_CARLO,
+	       INFERENCE_MODE_JUNCTION_TREE };
 
-	// TODO: make inference parameters more customizeable
+	/// Heuristics for choosing the order in which variables are eliminated.
+	/// Min-fill picks the variable whose elimination adds the fewest edges to
+	/// the interaction graph, min-degree the one with the fewest neighbours.
+	enum { ELIMINATION_MIN_FILL,
+	       ELIMINATION_MIN_DEGREE };
+
+	/// File formats that networks can be read from and written to: the
+	/// Bayesian Interchange Format, its XML version (XMLBIF 0.3) and the
+	/// Hugin .net format
+	enum { FORMAT_BIF,
+	       FORMAT_XMLBIF,
+	       FORMAT_HUGIN };
+
+	/// Scores that structure learning can rank network structures by: the
+	/// Bayesian information criterion and the Bayesian Dirichlet equivalent
+	/// uniform score
+	enum { SCORE_BIC,
+	       SCORE_BDEU };
+
+	/// Precisions in which a compiled network can store its probability
+	/// tables.  Single precision halves the memory taken by large tables;
+	/// inference still computes in double precision.
+	enum { PRECISION_DOUBLE,
+	       PRECISION_FLOAT };
+
+	/// Default number of samples drawn by the sampling methods
 	static const int MCMC_NUM_SAMPLES = 1000;
 
 	// bring some frequently-used classes into the namespace
@@ -52,16 +91,187 @@ namespace sbn
 	using std::set;
 	using std::map;
 	using std::runtime_error;
+	using std::shared_ptr;
 
 	// forward declarations
 	class Event;
 	class Node;
+	class CompiledNet;
+	class Factor;
+	class JunctionTree;
 	typedef map<string, string> ObservationMap;
 	typedef map<Event, double> ProbabilityMap;
 	typedef map<string, double> StateProbabilityMap;
+	typedef map<string, StateProbabilityMap> NodeProbabilityMap;
 	typedef map<string, Node*> NodeMap;
 	typedef vector<Node*> NodeVector;
 
+	/// A complete or partial configuration of a compiled network, holding one
+	/// state index per node id.  Nodes whose state is unknown hold STATE_UNSET.
+	typedef vector<int> Assignment;
+	static const int STATE_UNSET = -1;
+
+	/** Interns names as small integers.
+	 *
+	 * Names are numbered 0, 1, 2... in the order they are first added, so a
+	 * table can stand in for a vector of names that also answers reverse
+	 * lookups in constant time.
+	 */
+	class SymbolTable
+	{
+	public:
+		/// Returns the number of a name, adding it first if it is new
+		int intern(const string& name);
+
+		/// Returns the number of a name, or -1 if it was never added
+		int find(const string& name) const;
+
+		/// Returns the name with the given number
+		const string& get_name(int symbol) const;
+
+		/// Returns the number of names in the table
+		int size() const;
+
+		/// Returns true if the table has no names
+		bool empty() const;
+
+	private:
+		vector<string> m_names;
+		std::unordered_map<string, int> m_symbols;
+	};
+
+
+	/** Parameters for a query.  The sampling settings are ignored by the exact
+	 * inference methods.
+	 */
+	struct QueryOptions
+	{
+		/// Sets the defaults: MCMC_NUM_SAMPLES samples, no burn-in, no thinning,
+		/// one chain, pruning and no time limit
+		QueryOptions();
+
+		/// True if all the settings are the same
+		bool operator==(const QueryOptions& options) const;
+
+		/// Returns the point in time by which a query started now has to stop,
+		/// or the latest representable time if there is no time limit
+		std::chrono::steady_clock::time_point get_deadline() const;
+
+		/// Number of samples to draw (for MCMC, summed over all chains)
+		int num_samples;
+
+		/// Number of MCMC sweeps to discard before counting samples
+		int burn_in;
+
+		/// Number of MCMC sweeps per counted sample
+		int thinning;
+
+		/// Number of independent Markov chains to run in parallel
+		int num_chains;
+
+		/// Whether to drop the nodes that can't affect the answer (see
+		/// CompiledNet::prune()) before running the query.  On by default.  The
+		/// junction tree ignores it, since its tree covers the whole network.
+		bool prune;
+
+		/// Wall-clock budget in seconds, or zero for none.  When it runs out the
+		/// samplers stop early and return their estimate from the samples drawn
+		/// so far (always at least one).
+		double time_limit;
+	};
+
+
+	/** Parameters for structure learning.
+	 */
+	struct StructureOptions
+	{
+		/// Sets the defaults: the BIC score, an equivalent sample size of one,
+		/// at most three parents, plain hill climbing and at most 1000 steps
+		StructureOptions();
+
+		/// Score to maximize, one of the SCORE_* constants
+		int score;
+
+		/// Equivalent sample size of the BDeu prior
+		double equivalent_sample_size;
+
+		/// Largest number of parents a node may get
+		int max_parents;
+
+		/// Number of recently visited structures the search may not return to.
+		/// Zero stops at the first structure that no single change improves;
+		/// otherwise the search moves on through worse structures, giving up
+		/// after this many steps without finding a better one.
+		int tabu_size;
+
+		/// Largest number of links to add, remove or reverse
+		int max_iterations;
+	};
+
+
+	/** Many evidence sets for the same network, stored by column.
+	 *
+	 * Column i holds the observed state of node nodes[i] in every row, or
+	 * STATE_UNSET where the node is unobserved in that row.  Node ids and state
+	 * indices are those of the network's CompiledNet.
+	 */
+	struct EvidenceBatch
+	{
+		/// Returns the number of rows, which is zero if there are no columns
+		int num_rows() const;
+
+		/// Writes one row into a full assignment, leaving the nodes that have no
+		/// column untouched
+		void get_row(int row, Assignment& evidence) const;
+
+		/// Throws if the columns are of different lengths or hold node ids or
+		/// state indices that the model doesn't have
+		void validate(const CompiledNet& model) const throw(runtime_error);
+
+		vector<int> nodes;
+		vector< vector<int> > columns;
+	};
+
+
+	/** Random number generator used by the samplers (xoshiro256**).
+	 *
+	 * Every query or chain owns its own generator, so sampling never contends
+	 * for a shared one, and a generator seeded with the same value always
+	 * produces the same stream.  split() hands out non-overlapping streams for
+	 * parallel work.  The class meets the standard UniformRandomBitGenerator
+	 * requirements, so it also plugs into the <random> distributions.
+	 */
+	class RandomEngine
+	{
+	public:
+		typedef unsigned long long result_type;
+
+		/// Constructs a generator with the given seed
+		explicit RandomEngine(result_type seed = 0);
+
+		/// Restarts the stream from a new seed
+		void seed(result_type seed);
+
+		/// Returns the next 64 random bits
+		result_type operator()();
+
+		/// Returns a uniformly distributed number in [0, 1)
+		double next_double();
+
+		/// Advances the stream by 2^128 draws
+		void jump();
+
+		/// Returns a generator for the next 2^128 draws of this stream and moves
+		/// this one past them, so the two never overlap
+		RandomEngine split();
+
+		static result_type min() { return 0; }
+		static result_type max() { return ~0ULL; }
+
+	private:
+		result_type m_state[4];
+	};
+
 	/** Stores a possible configuration of variables in a Bayesian network, or a
 	 * set of observed values for nodes in a network.
 	 */
@@ -80,17 +290,26 @@ namespace sbn
 		/// Necessary for storing in std::map key
 		bool operator<(const Event& event) const;
 
-		/// For pretty printing
-		operator const char *();
+		/// True if both events set the same nodes to the same states
+		bool operator==(const Event& event) const;
+
+		/// Returns a hash of the observations.  It is computed on first use and
+		/// kept until the event changes.
+		size_t hash() const;
+
+		/// For pretty printing.  The string is built on first use and kept
+		/// until the event changes, so printing the same event from several
+		/// threads at once is not safe.
+		operator const char *() const;
 
 		/// Used to determine if a node is set in this event
-		bool has_node(const string& nodename);
+		bool has_node(const string& nodename) const;
 
 		/// Used to determine if a node is set to a specific state
-		bool node_has_state(const string& nodename, const string& state);
+		bool node_has_state(const string& nodename, const string& state) const;
 
 		/// Used to retrieve the state of a node that has been set
-		string get_node_state(const string& node) throw(runtime_error);
+		string get_node_state(const string& node) const throw(runtime_error);
 
 		/// Used to set observed variables for an event, also when setting the
 		/// conditional probability tables for a node
@@ -103,15 +322,23 @@ namespace sbn
 		void clear();
 
 	private:
-		void generate_string_representation();
+		void generate_string_representation() const;
+		void invalidate();
 		ObservationMap& get_observations();
 
 		ObservationMap m_observations;
-		string m_string_representation;
+
+		// derived from m_observations when first needed
+		mutable string m_string_representation;
+		mutable bool m_string_current;
+		mutable size_t m_hash;
+		mutable bool m_hash_current;
 
 		// Make Net a friend so that it can call methods which should not be a part
 		// of the public API, but which logically belong to this class
 		friend class Net;
+		friend class Node;
+		friend class CompiledNet;
 	};
 
 
@@ -131,7 +358,7 @@ namespace sbn
 		Node& operator=(const Node& node);
 
 		/// Returns node name
-		string get_name() const;
+		const string& get_name() const;
 
 		/// Adds another possible state that the node can be in
 		void add_state(const string& name);
@@ -142,8 +369,38 @@ namespace sbn
 		/// Makes the specified node a parent of this node
 		void add_parent(Node* parent);
 
-		/// Sets the probability of an event (i.e., a combination of node states)
-		void set_probability(Event e, double prob);
+		/// Removes the link to a child of this node
+		void remove_child(Node* child);
+
+		/// Removes the link to a parent of this node
+		void remove_parent(Node* parent);
+
+		/// Sets the probability of an event (i.e., a combination of node states).
+		/// The event has to give a state for this node and each of its parents,
+		/// so the parents must be added first.
+		void set_probability(Event e, double prob) throw(runtime_error);
+
+		/** Replaces the whole conditional probability table at once.
+		 *
+		 * The table holds one entry per combination of this node's state and its
+		 * parents' states, in the order Node::next_combination() enumerates them
+		 * (see get_probabilities()), so it must be set after all states and
+		 * parents have been added.  Changing the structure afterwards keeps what
+		 * it can: a new state starts at zero, in this table and in those of the
+		 * children, a new parent gets a copy of every row for each of its
+		 * states, and removing a parent keeps the rows for its first state.
+		 */
+		void set_probabilities(const vector<double>& table) throw(runtime_error);
+
+		/** Returns the conditional probability table as a flat array.
+		 *
+		 * The entry for P(node = s | parents = p1..pn) is at index
+		 * s * S + p1 * S1 + ... + pn * Sn, where each state is given by its index
+		 * in the order it was added, Sn is 1, each Si is the product of the
+		 * numbers of states of parents i+1..n, and S is the product over all
+		 * parents.  Combinations that were never set are zero.
+		 */
+		const vector<double>& get_probabilities();
 
 		/** Toggles an event to the next combination of possible states for this
 		 * node.
@@ -166,29 +423,973 @@ namespace sbn
 	 	Event& next_combination(Event& event) throw(runtime_error);
 
 	private:
-		bool can_be_evaluated(Event& evidence);
-		string get_random_state(Event& event);
-		string get_random_state_with_markov_blanket(Event& event);
-		void remove_irrelevant_states(ProbabilityMap& prob,
-		                              const string& state,
-		                              Event& evidence) throw(runtime_error);
-		double evaluate_marginal(const string& state,
-		                         Event& event) throw(runtime_error);
-		double evaluate_markov_blanket(const string& state,
-		                               Event& event) throw(runtime_error);
+		vector<int> get_table_sizes() const;
+		static vector<int> identity(size_t size);
+		void remap_table(const vector<int>& old_sizes, const vector<int>& sources);
+		int get_table_index(const string& state,
+		                    const ObservationMap& observations) const
+			throw(runtime_error);
 
-		static int m_count;
+		static std::atomic<int> m_count;
 		string m_name;
-		ProbabilityMap m_probabilities;
+
+		// the conditional probability table, laid out as get_probabilities()
+		// describes and remapped whenever a state or parent is added or removed
+		vector<double> m_table;
+
+		// incremented whenever the node's structure or probabilities change, so
+		// that a network can tell when its compiled model has gone stale
+		unsigned long m_revision;
 
 		// using vectors on these to preserve ordering information
 		NodeVector m_parents;
 		NodeVector m_children;
-		vector<string> m_states;
+		SymbolTable m_states;
 
 		// Make Net a friend so that it can call methods which should not be a part
 		// of the public API, but which logically belong to this class
 		friend class Net;
+		friend class CompiledNet;
+	};
+
+
+	/** An immutable, index-based snapshot of a network that the inference
+	 * engines run against.
+	 *
+	 * Compiling a network assigns every node an integer id (in the same order
+	 * in which Net stores its nodes) and every state an integer index (in the
+	 * order in which it was added to its node), records parent and child links
+	 * as id arrays, computes a topological order and flattens each node's
+	 * conditional probability table into a dense array.  Inference then works
+	 * on Assignment vectors instead of string-keyed Events, so the cost of a
+	 * probability lookup no longer depends on the size of the table.
+	 */
+	class CompiledNet
+	{
+	public:
+		/** Compiles the given nodes.  Every parent of a node must be in the map.
+		 *
+		 * The tables are stored in the given precision, one of the PRECISION_*
+		 * constants.  A model compiled for the log domain also keeps the log of
+		 * every table entry, which the samplers add up instead of multiplying
+		 * the entries, and the exact engines rescale their factors as they go.
+		 * Products of many small probabilities then no longer underflow to zero.
+		 */
+		CompiledNet(const NodeMap& nodes, int precision = PRECISION_DOUBLE,
+		            bool log_domain = false) throw(runtime_error);
+
+		/// Returns the precision the tables are stored in
+		int get_precision() const;
+
+		/// Tells whether the model was compiled for the log domain
+		bool is_log_domain() const;
+
+		/// Returns the number of nodes in the model
+		int num_nodes() const;
+
+		/// Returns the id of the named node
+		int get_node_id(const string& nodename) const throw(runtime_error);
+
+		/// Returns the name of the node with the given id
+		const string& get_node_name(int id) const;
+
+		/// Returns the number of states the node can be in
+		int get_num_states(int id) const;
+
+		/// Returns the index of the named state of a node
+		int get_state_index(int id, const string& state) const
+			throw(runtime_error);
+
+		/// Returns the name of a state of a node
+		const string& get_state_name(int id, int state) const;
+
+		/// Returns the ids of a node's parents, in the order they were linked
+		const vector<int>& get_parents(int id) const;
+
+		/// Returns the ids of a node's children, in the order they were linked
+		const vector<int>& get_children(int id) const;
+
+		/// Returns all node ids ordered so that parents precede their children
+		const vector<int>& get_topological_order() const;
+
+		/// Converts the observations in an event to an assignment
+		Assignment to_assignment(const Event& event) const throw(runtime_error);
+
+		/// Converts an assignment back to an event, skipping unset nodes
+		Event to_event(const Assignment& assignment) const;
+
+		/// Returns P(node = state | parents) with the parent states taken from
+		/// the assignment.  All parents must be set.
+		double get_probability(int id, int state,
+		                       const Assignment& assignment) const;
+
+		/// Returns the log of get_probability().  Only log-domain models keep
+		/// the logs; others compute them on the fly.
+		double get_log_probability(int id, int state,
+		                           const Assignment& assignment) const;
+
+		/// Returns a node's conditional probability table as a factor over the
+		/// node and its parents
+		Factor get_factor(int id) const;
+
+		/// Returns the moral graph (parents married, links undirected) as an
+		/// adjacency list, leaving out the nodes that are set in the evidence
+		vector< set<int> > get_moral_graph(const Assignment& evidence) const;
+
+		/** Chooses an elimination order for the unobserved nodes.
+		 *
+		 * The interaction graph is the moral graph with the nodes that are set in
+		 * the evidence removed.  Every remaining node except those in keep is
+		 * eliminated, greedily picking the next one with the given heuristic.
+		 */
+		vector<int> get_elimination_order(const Assignment& evidence,
+		                                  const vector<int>& keep,
+		                                  int heuristic = ELIMINATION_MIN_FILL) const;
+
+		/// Draws a state for a node given the states of its parents
+		int sample_state(int id, const Assignment& assignment,
+		                 RandomEngine& rng) const;
+
+		/// Draws a state for every unset node, visiting the nodes in topological
+		/// order so that each one's parents are already set
+		void sample_forward(Assignment& assignment, RandomEngine& rng) const;
+
+		/// Draws a state for a node given the states of its Markov blanket.
+		/// weights is scratch space for the unnormalized distribution, which
+		/// callers can keep between calls to avoid allocating.
+		int sample_markov_blanket(int id, const Assignment& assignment,
+		                          RandomEngine& rng,
+		                          vector<double>& weights) const;
+
+		/** Finds the nodes that the posteriors of the query nodes depend on.
+		 *
+		 * tables[id] is set for the nodes whose conditional probability tables
+		 * matter, and observations[id] for the evidence nodes whose observed
+		 * states matter.  Everything else is barren or d-separated from the
+		 * query nodes by the evidence.
+		 */
+		void get_requisite_nodes(const vector<int>& ids, const Assignment& evidence,
+		                         vector<bool>& tables,
+		                         vector<bool>& observations) const;
+
+		/** Returns a smaller model that gives the same posteriors for the query
+		 * nodes under the given evidence.
+		 *
+		 * Only the nodes found by get_requisite_nodes() and the query nodes are
+		 * kept.  A node that is kept only for its observed state loses its
+		 * parents and puts all of its probability on that state.  mapping[id] is
+		 * set to the id of each node in the pruned model, or -1 if it was left
+		 * out.  Dropping barren nodes relies on every row of their tables
+		 * summing to one.
+		 */
+		CompiledNet prune(const vector<int>& ids, const Assignment& evidence,
+		                  vector<int>& mapping) const;
+
+		/** Writes the model to a file that load() can map back in.
+		 *
+		 * The file holds a versioned header, the node and state names, the
+		 * links, and then the tables exactly as they are laid out in memory, in
+		 * the model's precision and followed by the log tables in the log
+		 * domain.  Files are only read back on machines with the same byte
+		 * order.
+		 */
+		void save(const string& filename) const throw(runtime_error);
+
+		/** Loads a model written by save().
+		 *
+		 * The file is mapped into memory read-only and the tables are used
+		 * where they lie, so loading only reads the names and links, and
+		 * processes that load the same file share one copy of the tables in the
+		 * page cache.  The mapping lasts as long as the model or any copy of it.
+		 */
+		static shared_ptr<const CompiledNet> load(const string& filename)
+			throw(runtime_error);
+
+	private:
+		CompiledNet();
+		void layout() throw(runtime_error);
+		size_t get_tables_size() const;
+		void set_tables(shared_ptr<void> tables);
+		int get_row_offset(int id, const Assignment& assignment) const;
+		double get_entry(int index) const;
+		void set_entry(int index, double value);
+
+		template <class T>
+		int sample_state(const T *cpt, int id, const Assignment& assignment,
+		                 RandomEngine& rng) const;
+		template <class T>
+		void get_blanket_weights(const T *cpt, int id, const Assignment& assignment,
+		                         vector<double>& weights) const;
+
+		SymbolTable m_names;
+		vector<SymbolTable> m_states;
+		vector< vector<int> > m_parents;
+		vector< vector<int> > m_children;
+		vector<int> m_order;
+
+		// All conditional probability tables live in one contiguous array.  The
+		// table for node i starts at m_cpt_offsets[i] and is laid out in the
+		// order Node::next_combination() enumerates: the node's own state is the
+		// most significant digit and its last parent the least significant.
+		// Only the array for the model's precision is set, and the log array
+		// only in the log domain.  The arrays live in a block owned by
+		// m_tables, which is either heap memory or, for a model loaded from a
+		// file, the file's read-only mapping; copies of the model share it, as
+		// the tables never change once the model is built.
+		int m_precision;
+		bool m_log_domain;
+		size_t m_num_entries;
+		shared_ptr<void> m_tables;
+		double *m_cpt;
+		float *m_cpt_float;
+		double *m_log_cpt;
+		float *m_log_cpt_float;
+		vector<int> m_cpt_offsets;
+		vector<int> m_state_strides;
+		vector< vector<int> > m_parent_strides;
+
+		// m_child_strides[i][c] is the stride of node i in the table of its
+		// child m_children[i][c], for resampling i from its Markov blanket
+		vector< vector<int> > m_child_strides;
+	};
+
+
+	/** Loops over contiguous arrays of table entries, the inner loops of factor
+	 * multiplication, division, marginalization, maximization and
+	 * normalization.
+	 *
+	 * Each loop has a scalar version and, on x86, versions for AVX2 and AVX-512.
+	 * The best instruction set the processor supports is picked the first time
+	 * a loop runs; set_instruction_set() can pick an older one, for instance to
+	 * compare results.  Division by zero gives zero, as in Factor::divide().
+	 */
+	namespace kernels
+	{
+		/// Instruction sets the loops can be compiled for
+		enum { KERNEL_SCALAR,
+		       KERNEL_AVX2,
+		       KERNEL_AVX512 };
+
+		/// Returns the instruction set in use
+		int get_instruction_set();
+
+		/// Selects an instruction set, falling back to the best one the processor
+		/// supports, and returns the one that will be used
+		int set_instruction_set(int instruction_set);
+
+		/// out[i] = a[i] * b[i]
+		void multiply(double *out, const double *a, const double *b, size_t n);
+		void multiply(float *out, const float *a, const float *b, size_t n);
+
+		/// out[i] = a[i] * b
+		void multiply(double *out, const double *a, double b, size_t n);
+		void multiply(float *out, const float *a, float b, size_t n);
+
+		/// out[i] = a[i] / b[i]
+		void divide(double *out, const double *a, const double *b, size_t n);
+		void divide(float *out, const float *a, const float *b, size_t n);
+
+		/// out[i] = a[i] / b
+		void divide(double *out, const double *a, double b, size_t n);
+		void divide(float *out, const float *a, float b, size_t n);
+
+		/// out[i] = a / b[i]
+		void divide(double *out, double a, const double *b, size_t n);
+		void divide(float *out, float a, const float *b, size_t n);
+
+		/// target[i] += source[i]
+		void add(double *target, const double *source, size_t n);
+		void add(float *target, const float *source, size_t n);
+
+		/// target[i] = max(target[i], source[i])
+		void maximum(double *target, const double *source, size_t n);
+		void maximum(float *target, const float *source, size_t n);
+
+		/// Returns the sum of the values
+		double sum(const double *values, size_t n);
+		float sum(const float *values, size_t n);
+
+		/// values[i] *= factor
+		void scale(double *values, double factor, size_t n);
+		void scale(float *values, float factor, size_t n);
+	}
+
+
+	/** A function over a set of discrete variables, stored as a dense table.
+	 *
+	 * Variables are node ids of a CompiledNet.  The table is laid out like a
+	 * conditional probability table: the first variable is the most significant
+	 * digit of the index and the last variable the least significant, so the
+	 * factor for a node's table has the node followed by its parents.
+	 */
+	class Factor
+	{
+	public:
+		/// Constructs a factor without variables holding the constant 1
+		Factor();
+
+		/// Constructs a factor over the given variables, filled with zeros
+		Factor(const vector<int>& variables, const vector<int>& cardinalities);
+
+		/// Returns the variables of the factor
+		const vector<int>& get_variables() const;
+
+		/// Returns the number of states of each variable
+		const vector<int>& get_cardinalities() const;
+
+		/// Used to determine if a variable is part of the factor
+		bool has_variable(int variable) const;
+
+		/// Returns the number of entries in the table
+		size_t size() const;
+
+		/// Returns the table
+		vector<double>& get_values();
+		const vector<double>& get_values() const;
+
+		/// Multiplies two factors.  The result ranges over the variables of
+		/// this factor followed by those of the other factor not already present.
+		Factor product(const Factor& factor) const;
+
+		/// Sums a variable out of the factor
+		Factor sum_out(int variable) const throw(runtime_error);
+
+		/// Maxes a variable out of the factor, keeping the largest entry over
+		/// its states instead of their sum
+		Factor max_out(int variable) const throw(runtime_error);
+
+		/// Divides two factors, taking 0 / 0 to be 0.  The result ranges over the
+		/// same variables as product() would give.
+		Factor divide(const Factor& factor) const;
+
+		/// Sums out every variable that is not in the given list
+		Factor marginal(const vector<int>& variables) const;
+
+		/// Returns the slice of the factor in which a variable has the given state
+		Factor reduce(int variable, int state) const throw(runtime_error);
+
+		/// Zeroes every entry in which a variable is not in the given state,
+		/// keeping the variable in the factor
+		void set_evidence(int variable, int state) throw(runtime_error);
+
+		/// Scales the table so that it sums to one and returns the old sum
+		double normalize();
+
+	private:
+		Factor combine(const Factor& factor, bool quotient) const;
+		int find_variable(int variable) const throw(runtime_error);
+		void compute_strides();
+
+		vector<int> m_variables;
+		vector<int> m_cardinalities;
+		vector<int> m_strides;
+		vector<double> m_values;
+	};
+
+
+	/** Exact inference by variable elimination.
+	 *
+	 * Every node's table is turned into a factor and reduced by the evidence,
+	 * then the unobserved nodes other than the query node are summed out one at
+	 * a time, in an order chosen by an elimination heuristic.  What remains is
+	 * the unnormalized posterior of the query node.
+	 */
+	class VariableElimination
+	{
+	public:
+		/// Constructs an engine for a compiled network
+		VariableElimination(const CompiledNet& model,
+		                    int heuristic = ELIMINATION_MIN_FILL);
+
+		/// Returns the posterior of a node, indexed by state
+		vector<double> query(int id, const Assignment& evidence) const
+			throw(runtime_error);
+
+		/** Finds the jointly most likely states of some nodes given the
+		 * evidence, by max-product elimination.
+		 *
+		 * The other unobserved nodes are summed out first, and the given ones
+		 * then maxed out.  Each maxed-out node's bucket is kept, so that once
+		 * the last one is gone the states can be read back in the reverse
+		 * order, each one the best given those already chosen.  No ids means
+		 * every unobserved node, which gives the most probable explanation.
+		 * The result holds the evidence and the chosen states; ties go to the
+		 * lower state index.
+		 */
+		Assignment maximize(const vector<int>& ids, const Assignment& evidence) const
+			throw(runtime_error);
+
+	private:
+		vector<Factor> get_factors(const Assignment& evidence) const;
+		Factor eliminate(vector<Factor>& factors, int id, bool maximize) const;
+
+		const CompiledNet& m_model;
+		int m_heuristic;
+	};
+
+
+	/** Exact inference on a junction tree (clique tree).
+	 *
+	 * The moral graph of the network is triangulated by eliminating its nodes
+	 * in heuristic order, the maximal cliques that this produces are joined into
+	 * a maximum-weight spanning tree (weighted by separator size), and each node
+	 * table is assigned to one clique that contains its family.  Calibrating the
+	 * tree against some evidence runs Hugin-style message passing towards the
+	 * root and back, after which the marginal of every node can be read from
+	 * any clique that contains it.  The calibration is kept until the tree is
+	 * calibrated against different evidence.
+	 */
+	class JunctionTree
+	{
+	public:
+		/// Builds the tree for a compiled network
+		JunctionTree(const CompiledNet& model,
+		             int heuristic = ELIMINATION_MIN_FILL);
+
+		/// Propagates the evidence through the tree, unless the tree is already
+		/// calibrated for the same evidence.  Findings added since the last
+		/// calibration are propagated from the cliques they fall in.  Retracting
+		/// or changing a finding reloads the whole tree.
+		void calibrate(const Assignment& evidence) throw(runtime_error);
+
+		/// Returns the posterior of a node, indexed by state
+		vector<double> get_marginal(int id) const throw(runtime_error);
+
+		/// Returns the posteriors of all nodes, indexed by node id
+		vector< vector<double> > get_marginals() const throw(runtime_error);
+
+		/// Returns the joint posterior of a node and its parents, laid out like
+		/// the node's conditional probability table
+		vector<double> get_family_marginal(int id) const throw(runtime_error);
+
+		/// Returns the number of cliques in the tree
+		int num_cliques() const;
+
+		/// Returns the node ids that make up a clique
+		const vector<int>& get_clique(int clique) const;
+
+	private:
+		void load(const Assignment& evidence);
+		void propagate();
+		void distribute(int clique);
+		void pass_message(int from, int to, int separator);
+
+		const CompiledNet& m_model;
+		vector< vector<int> > m_cliques;
+
+		// tree rooted at clique 0; the separator between a clique and its
+		// parent is stored at the clique's own index
+		vector<int> m_parents;
+		vector< vector<int> > m_children;
+		vector<int> m_order;
+		vector<int> m_node_cliques;
+
+		vector<Factor> m_potentials;
+		vector<Factor> m_separators;
+		Assignment m_evidence;
+		bool m_calibrated;
+	};
+
+
+	/** Approximate inference by sampling the network from its roots down.
+	 *
+	 * Both methods draw nodes in topological order, each given its already
+	 * drawn parents.  Rejection sampling draws every node and throws away the
+	 * samples that disagree with the evidence.  Likelihood weighting keeps the
+	 * evidence nodes fixed instead and weights each sample by the probability
+	 * of the evidence given its parents, so no samples are wasted.
+	 */
+	class ForwardSampler
+	{
+	public:
+		/// Constructs a sampler for a compiled network
+		ForwardSampler(const CompiledNet& model);
+
+		/// Estimates the posteriors of the nodes by rejection sampling
+		vector< vector<double> > rejection_sampling(const vector<int>& ids,
+		                                            const Assignment& evidence,
+		                                            const QueryOptions& options,
+		                                            RandomEngine& rng) const
+			throw(runtime_error);
+
+		/// Estimates the posteriors of the nodes by likelihood weighting
+		vector< vector<double> > likelihood_weighting(const vector<int>& ids,
+		                                              const Assignment& evidence,
+		                                              const QueryOptions& options,
+		                                              RandomEngine& rng) const
+			throw(runtime_error);
+
+	private:
+		const CompiledNet& m_model;
+	};
+
+
+	/** A fixed set of worker threads that runs batches of independent tasks.
+	 *
+	 * run() hands out task indices 0..n-1 to the workers and returns once all
+	 * of them have finished.  The task is also told which worker runs it, so
+	 * callers can keep one scratch buffer per worker.
+	 */
+	class ThreadPool
+	{
+	public:
+		typedef std::function<void(int task, int worker)> Task;
+
+		/// Starts the workers.  Zero means one per hardware thread.
+		ThreadPool(int num_threads = 0);
+
+		/// Stops and joins the workers
+		~ThreadPool();
+
+		/// Returns the number of workers
+		int num_threads() const;
+
+		/// Runs task(i, worker) for every i below num_tasks and waits for all of
+		/// them.  If a task throws, the first exception is rethrown here.
+		void run(int num_tasks, const Task& task);
+
+	private:
+		ThreadPool(const ThreadPool&);
+		ThreadPool& operator=(const ThreadPool&);
+		void work(int worker);
+
+		vector<std::thread> m_threads;
+		std::mutex m_run_mutex;
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+		const Task *m_task;
+		int m_num_tasks;
+		int m_next_task;
+		int m_remaining;
+		bool m_stopping;
+		std::exception_ptr m_error;
+	};
+
+
+	/** Approximate inference by Gibbs sampling (Markov chain Monte Carlo).
+	 *
+	 * A chain starts from a forward sample that agrees with the evidence and
+	 * then repeatedly resamples every unobserved node given its Markov blanket.
+	 * Several independent chains can be run in parallel on a thread pool, in
+	 * which case their visit counts are added together.
+	 */
+	class GibbsSampler
+	{
+	public:
+		/// Constructs a sampler for a compiled network
+		GibbsSampler(const CompiledNet& model);
+
+		/** Runs a single chain and returns how often each of the nodes was in
+		 * each of its states.
+		 *
+		 * The chain starts from state, with the evidence filled in and any node
+		 * still unset drawn by forward sampling, so an empty state gives a cold
+		 * start.  It discards options.burn_in sweeps, then counts the nodes'
+		 * states after every options.thinning sweeps until num_samples have been
+		 * counted or the deadline passes, and leaves its last state in state.
+		 * Every sweep assigns every node, so counting more nodes costs next to
+		 * nothing.
+		 */
+		vector< vector<int> > run_chain(const vector<int>& ids,
+		                                const Assignment& evidence,
+		                                const QueryOptions& options,
+		                                int num_samples,
+		                                std::chrono::steady_clock::time_point deadline,
+		                                RandomEngine& rng, Assignment& state) const;
+
+		/// Estimates the posteriors of the nodes with a single chain, starting
+		/// from and updating state
+		vector< vector<double> > query(const vector<int>& ids,
+		                               const Assignment& evidence,
+		                               const QueryOptions& options,
+		                               RandomEngine& rng, Assignment& state) const;
+
+		/// Estimates the posteriors of the nodes by splitting the samples
+		/// between options.num_chains independent chains that run on the pool.
+		/// states holds one starting state per chain and is updated like state
+		/// in run_chain().
+		vector< vector<double> > query(const vector<int>& ids,
+		                               const Assignment& evidence,
+		                               const QueryOptions& options,
+		                               ThreadPool& pool, RandomEngine& rng,
+		                               vector<Assignment>& states) const;
+
+	private:
+		static vector< vector<double> > normalize(const vector< vector<int> >& frequencies);
+
+		const CompiledNet& m_model;
+	};
+
+
+	/** Evidence and scratch space for queries against a compiled network.
+	 *
+	 * A compiled network is never modified by a query, so any number of threads
+	 * can query the same one at once without locking, provided each thread
+	 * uses its own context.  A context remembers its evidence, keeps its
+	 * junction tree calibrated between queries, starts each Markov chain where
+	 * the previous query left it and owns the generator that its sampling
+	 * queries draw from.
+	 */
+	class QueryContext
+	{
+	public:
+		/// Creates a context without evidence
+		QueryContext(shared_ptr<const CompiledNet> model,
+		             int mode = INFERENCE_MODE_MARKOV_CHAIN_MONTE_CARLO,
+		             unsigned long long seed = 0) throw(runtime_error);
+
+		/// Copies the model, evidence, mode and generator, but not the scratch
+		/// space, so the copy can be handed to another thread
+		QueryContext(const QueryContext& context);
+
+		/// Copy assignment, with the same rules as the copy constructor
+		QueryContext& operator=(const QueryContext& context);
+
+		/// Returns the network the queries run against
+		shared_ptr<const CompiledNet> get_model() const;
+
+		/// Switches to another network, keeping the mode and the generator but
+		/// dropping the evidence
+		void set_model(shared_ptr<const CompiledNet> model);
+
+		/// Selects the algorithm, one of the INFERENCE_MODE_* constants
+		void set_inference_mode(int mode) throw(runtime_error);
+
+		/// Returns the algorithm used by the queries
+		int get_inference_mode() const;
+
+		/// Sets the observed states of some nodes, replacing earlier evidence
+		void set_evidence(const Event& e) throw(runtime_error);
+
+		/// Same as set_evidence(), for an assignment of the model
+		void set_evidence(const Assignment& evidence) throw(runtime_error);
+
+		/// Returns the evidence as an assignment of the model
+		const Assignment& get_evidence() const;
+
+		/// Adds a finding to the evidence, or changes it if the node was
+		/// already observed
+		void add_evidence(int id, int state) throw(runtime_error);
+
+		/// Removes a node from the evidence
+		void retract_evidence(int id) throw(runtime_error);
+
+		/// Returns the generator the sampling queries draw from
+		RandomEngine& get_random();
+
+		/// Reseeds the generator and forgets where the Markov chains were, so
+		/// that the queries that follow are reproducible
+		void seed(unsigned long long seed);
+
+		/// Replaces the generator, and like seed() forgets where the Markov
+		/// chains were
+		void set_random(const RandomEngine& rng);
+
+		/// Returns the posteriors of the nodes, indexed like ids and then by
+		/// state.  Markov chains are run on the pool when one is given and
+		/// options.num_chains is more than one.
+		vector< vector<double> > query(const vector<int>& ids,
+		                               const QueryOptions& options,
+		                               ThreadPool *pool = 0) throw(runtime_error);
+
+		/// Returns a probability for each possible state in the requested node
+		StateProbabilityMap query_node(const string& nodename,
+		                               const QueryOptions& options = QueryOptions())
+			throw(runtime_error);
+
+		/** Returns the jointly most likely states of the given nodes under the
+		 * evidence, summing over the other unobserved nodes.  Only the given
+		 * nodes are set in the result.
+		 *
+		 * Whatever the inference mode, the answer comes from max-product
+		 * variable elimination (see VariableElimination::maximize()): the
+		 * states that are each most likely on their own need not be most likely
+		 * together.
+		 */
+		Assignment query_map(const vector<int>& ids) throw(runtime_error);
+
+		/// Returns the most probable explanation of the evidence: the jointly
+		/// most likely states of all the unobserved nodes, together with the
+		/// evidence
+		Assignment query_mpe() throw(runtime_error);
+
+	private:
+		shared_ptr<const CompiledNet> m_model;
+		int m_inference_mode;
+		Assignment m_evidence;
+		shared_ptr<JunctionTree> m_junction_tree;
+		RandomEngine m_random;
+
+		// where each Markov chain stopped, by node id of m_model; the next
+		// MCMC query carries on from there
+		vector<Assignment> m_chains;
+
+		// model pruned for the last query, and what it was pruned for
+		shared_ptr<const CompiledNet> m_pruned;
+		vector<int> m_pruned_ids;
+		Assignment m_pruned_evidence;
+		vector<int> m_pruned_mapping;
+	};
+
+
+	/** A least-recently-used cache of query results.
+	 *
+	 * Results are keyed by the evidence, the ids of the query nodes, the
+	 * inference mode and the query options.  The cache knows nothing about the
+	 * model, so it has to be cleared whenever the model changes.
+	 */
+	class QueryCache
+	{
+	public:
+		/// Creates a cache holding up to capacity results (none if zero)
+		QueryCache(size_t capacity = 0);
+
+		/// Changes how many results are kept, dropping the oldest if needed
+		void set_capacity(size_t capacity);
+
+		/// Returns how many results can be kept
+		size_t get_capacity() const;
+
+		/// Returns how many results are currently kept
+		size_t size() const;
+
+		/// Looks up a result and marks it as the most recently used
+		bool find(const Event& evidence, const vector<int>& ids, int mode,
+		          const QueryOptions& options,
+		          vector< vector<double> >& result);
+
+		/// Stores a result, dropping the least recently used one if full
+		void insert(const Event& evidence, const vector<int>& ids, int mode,
+		            const QueryOptions& options,
+		            const vector< vector<double> >& result);
+
+		/// Drops all results
+		void clear();
+
+	private:
+		struct Entry
+		{
+			size_t hash;
+			Event evidence;
+			vector<int> ids;
+			int mode;
+			QueryOptions options;
+			vector< vector<double> > result;
+		};
+		typedef std::list<Entry> EntryList;
+		typedef std::unordered_multimap<size_t, EntryList::iterator> EntryIndex;
+
+		static size_t get_hash(const Event& evidence, const vector<int>& ids,
+		                       int mode, const QueryOptions& options);
+		EntryIndex::iterator find_entry(size_t hash, const Event& evidence,
+		                                const vector<int>& ids, int mode,
+		                                const QueryOptions& options);
+		void evict();
+
+		size_t m_capacity;
+
+		// most recently used first
+		EntryList m_entries;
+		EntryIndex m_index;
+	};
+
+
+	/** Reads observations from a comma-separated file, a block of rows at a
+	 * time, so that files much larger than memory can be processed.
+	 *
+	 * The first line names a node of the model in every column, and each
+	 * later line gives one state per column.  An empty field or a question
+	 * mark means the node was not observed.  Fields may be enclosed in double
+	 * quotes, but may not span lines.  Reading the blocks is sequential, but
+	 * parse() only looks at its arguments, so blocks can be parsed on several
+	 * threads at once.
+	 */
+	class DataReader
+	{
+	public:
+		/// Reads the header line.  Throws if a column names a node the model
+		/// doesn't have, or names a node twice.
+		DataReader(std::istream& in, shared_ptr<const CompiledNet> model)
+			throw(runtime_error);
+
+		/// Returns the node id of each column
+		const vector<int>& get_nodes() const;
+
+		/** Reads whole lines up to about the given number of bytes into text,
+		 * and sets line to the number of the first one in the file.  Returns
+		 * false once the file is exhausted.
+		 */
+		bool next_block(string& text, long& line, size_t size = 1 << 20)
+			throw(runtime_error);
+
+		/// Converts the lines of a block to state indices, replacing the rows
+		/// of the batch.  line is the one next_block() returned, for error
+		/// messages.
+		void parse(const string& text, long line, EvidenceBatch& batch) const
+			throw(runtime_error);
+
+		/// Reads the rest of the file into a batch, replacing its rows
+		void read(EvidenceBatch& batch) throw(runtime_error);
+
+	private:
+		bool find_state(int column, const char *begin, const char *end,
+		                string& scratch, int& state) const;
+
+		std::istream& m_in;
+		shared_ptr<const CompiledNet> m_model;
+		vector<int> m_nodes;
+
+		// the state names of each column's node, for looking up fields
+		vector<SymbolTable> m_states;
+
+		// start of a line that didn't fit in the last block
+		string m_rest;
+
+		// number of the next line to be read
+		long m_line;
+	};
+
+
+	/** Collects the counts that each node's conditional probability table is
+	 * estimated from.
+	 *
+	 * Counts are kept in flat arrays laid out like the model's tables, so the
+	 * count for a node's state under a combination of its parents' states is
+	 * at the same index as the probability it becomes.  A row only counts
+	 * towards a node's table if the node and all of its parents are observed in
+	 * it.  Counting a data file spreads the blocks over a thread pool, each
+	 * worker adding to its own copy of the counts until they are merged at the
+	 * end, so the work scales with the number of cores and only a few blocks
+	 * per worker are ever held in memory.
+	 */
+	class ParameterLearner
+	{
+	public:
+		/// Starts with all counts at zero
+		ParameterLearner(shared_ptr<const CompiledNet> model);
+
+		/// Returns the model the counts are for
+		shared_ptr<const CompiledNet> get_model() const;
+
+		/// Adds the rows of a batch to the counts
+		void add(const EvidenceBatch& batch);
+
+		/// Reads the rest of a data file and adds its rows to the counts
+		void add(DataReader& reader, ThreadPool& pool) throw(runtime_error);
+
+		/** Adds the expected counts of the rows of a batch under the model.
+		 *
+		 * Each row adds the posterior of every node's family given what the
+		 * row observes, which is the row's own count where the whole family is
+		 * observed, so nodes that are never observed get counts as well.  The
+		 * tree has to be built on the learner's model; rows that observe every
+		 * node don't need it.  These are the sufficient statistics of the
+		 * expectation step of expectation maximization.
+		 */
+		void add_expected(const EvidenceBatch& batch, JunctionTree& tree)
+			throw(runtime_error);
+
+		/// Reads the rest of a data file and adds the expected counts of its
+		/// rows, with one junction tree per worker
+		void add_expected(DataReader& reader, ThreadPool& pool)
+			throw(runtime_error);
+
+		/// Adds the counts collected by another learner for the same model
+		void merge(const ParameterLearner& learner);
+
+		/// Returns the number of rows added so far
+		double get_num_rows() const;
+
+		/// Returns the counts for a node's table
+		const vector<double>& get_counts(int id) const;
+
+		/** Returns the table estimated for a node.
+		 *
+		 * Every count is increased by the prior before the counts for each
+		 * combination of parent states are normalized.  Zero gives the maximum
+		 * likelihood estimate; a positive prior gives the maximum a posteriori
+		 * estimate under a Dirichlet prior with parameters prior + 1, which
+		 * keeps states that never occurred from getting zero probability.  A
+		 * combination of parent states without any counts gets a uniform
+		 * distribution.
+		 */
+		vector<double> get_table(int id, double prior = 0) const
+			throw(runtime_error);
+
+	private:
+		int get_family_index(int id, const Assignment& row) const;
+		void add(DataReader& reader, ThreadPool& pool, bool expected)
+			throw(runtime_error);
+
+		shared_ptr<const CompiledNet> m_model;
+		double m_num_rows;
+		vector< vector<double> > m_counts;
+
+		// m_strides[i][0] is the stride of node i's state in its table, and
+		// m_strides[i][p + 1] that of its parent p
+		vector< vector<int> > m_strides;
+	};
+
+
+	/** Searches for the links that best explain a dataset by score-based
+	 * local search.
+	 *
+	 * Starting from the model's links, every step tries adding, removing and
+	 * reversing each single link that keeps the graph acyclic and respects the
+	 * parent limit, and makes the change that raises the score the most.  The
+	 * score of a structure is the sum of the scores of the families (a node and
+	 * its parents) in it, and a change only alters one or two of them, so
+	 * family scores are cached and most candidates are ranked without looking
+	 * at the data.  A family that isn't cached yet is scored in one pass over
+	 * the data; all the families a step needs are scored in parallel.  Only
+	 * the rows in which every node is observed are scored, so that all the
+	 * families are compared on the same rows.  Incomplete data is better used
+	 * by Net::learn_parameters_em() once the structure is known.
+	 */
+	class StructureLearner
+	{
+	public:
+		/// Prepares a search over the nodes of the model.  The data has to stay
+		/// around as long as the learner.
+		StructureLearner(shared_ptr<const CompiledNet> model,
+		                 const EvidenceBatch& data,
+		                 const StructureOptions& options = StructureOptions())
+			throw(runtime_error);
+
+		/// Returns the score of a node with the given parents, computing it
+		/// only if it isn't cached
+		double get_score(int id, const vector<int>& parents);
+
+		/// Returns the score of a whole structure, given each node's parents
+		double get_score(const vector< vector<int> >& parents);
+
+		/// Runs the search and returns the parents of each node in the best
+		/// structure found, in increasing order of node id
+		vector< vector<int> > search(ThreadPool& pool) throw(runtime_error);
+
+		/// Returns the number of family scores in the cache
+		size_t get_cache_size() const;
+
+	private:
+		typedef map<vector<int>, double> ScoreCache;
+
+		double compute_score(int id, const vector<int>& parents) const;
+		void cache_scores(const vector< std::pair<int, vector<int> > >& families,
+		                  ThreadPool& pool);
+
+		shared_ptr<const CompiledNet> m_model;
+		const EvidenceBatch& m_data;
+		StructureOptions m_options;
+
+		// column of the data holding each node, or -1
+		vector<int> m_columns;
+
+		// rows of the data in which no column is unobserved
+		vector<int> m_rows;
+
+		// scores of the families of each node, keyed by the sorted parent ids
+		vector<ScoreCache> m_scores;
 	};
 
 
@@ -204,8 +1405,8 @@ namespace sbn
 	 	 *
 	 	 * Constructs a new network.  If a title for a network is not specified, it
 	 	 * gets set to  Net1, Net2, etc.  depending on how many networks have already
-	 	 * been created. Title is used to export network to a file--a feature that is
-	 	 * still pending.
+	 	 * been created. Title is used to name the network when it is written to a
+	 	 * file.
 	 	 */
 		Net(const string& title = "");
 
@@ -221,17 +1422,266 @@ namespace sbn
 		/// Used to indicate the observed states of some nodes in the network.
 		void set_evidence(Event& e);
 
+		/** Adds a single finding to the evidence, or changes it if the node was
+		 * already observed.
+		 *
+		 * The next query reuses what the previous one worked out: the junction
+		 * tree only propagates the new finding, and Markov chains carry on from
+		 * their last state.
+		 */
+		void add_evidence(const string& nodename, const string& state);
+
+		/// Removes a node from the evidence
+		void retract_evidence(const string& nodename);
+
 		/// Returns a probability for each possible state in the requested node.
 		StateProbabilityMap query_node(string nodename);
 
+		/// Same as query_node(), with the given options instead of the ones
+		/// set for the network
+		StateProbabilityMap query_node(string nodename,
+		                               const QueryOptions& options);
+
+		/// Returns the posteriors of several nodes, keyed by node name.  The
+		/// sampling methods tally all of them from a single run, so this is much
+		/// cheaper than querying the nodes one at a time.
+		NodeProbabilityMap query_nodes(const vector<string>& nodenames);
+
+		/// Same as query_nodes(), with the given options instead of the ones
+		/// set for the network
+		NodeProbabilityMap query_nodes(const vector<string>& nodenames,
+		                               const QueryOptions& options);
+
+		/** Answers one query per row of an evidence batch.  The evidence set
+		 * on the network is not used.
+		 *
+		 * The rows are spread over the network's thread pool.  The result is
+		 * indexed by row, then by position in nodenames, then by state index.
+		 * Each sampling query runs a single chain, with its own stream split off
+		 * the network's generator before the work starts, so the answers don't
+		 * depend on how the rows are scheduled.  Junction tree queries keep one
+		 * tree per worker and recalibrate it for each of that worker's rows.
+		 */
+		vector< vector< vector<double> > > query_batch(const EvidenceBatch& batch,
+		                                               const vector<string>& nodenames)
+			throw(runtime_error);
+
+		/// Same as query_batch(), with the given options instead of the ones
+		/// set for the network
+		vector< vector< vector<double> > > query_batch(const EvidenceBatch& batch,
+		                                               const vector<string>& nodenames,
+		                                               const QueryOptions& options)
+			throw(runtime_error);
+
+		/** Returns a context for querying the current network from another
+		 * thread.
+		 *
+		 * The context starts out with the network's evidence and inference mode
+		 * and a generator split off the network's.  The Net itself is not safe
+		 * to share between threads, but the contexts are independent of it and
+		 * of each other.
+		 */
+		QueryContext new_context() throw(runtime_error);
+
+		/// Returns the posteriors of every node in the network
+		NodeProbabilityMap query_all_nodes();
+
+		/** Returns the most probable explanation of the evidence, the most
+		 * likely configuration of the whole network, as an event that sets
+		 * every node.
+		 *
+		 * This is computed exactly by max-product variable elimination in every
+		 * inference mode, since taking the most likely state of each node's
+		 * marginal separately can give a configuration that is unlikely or
+		 * even impossible.
+		 */
+		Event query_mpe();
+
+		/// Returns the jointly most likely states of the given nodes, summing
+		/// over the other unobserved ones, as an event that sets only those
+		/// nodes (the maximum a posteriori configuration)
+		Event query_map(const vector<string>& nodenames);
+
+		/// Same as query_all_nodes(), with the given options instead of the
+		/// ones set for the network
+		NodeProbabilityMap query_all_nodes(const QueryOptions& options);
+
+		/// Sets the options used by queries that don't specify their own
+		void set_query_options(const QueryOptions& options);
+
+		/// Returns the options used by queries that don't specify their own
+		const QueryOptions& get_query_options() const;
+
+		/// Selects the algorithm used by query_node(), one of the
+		/// INFERENCE_MODE_* constants.  The default is Markov chain Monte Carlo.
+		void set_inference_mode(int mode) throw(runtime_error);
+
+		/// Returns the algorithm used by query_node()
+		int get_inference_mode() const;
+
+		/// Sets how many independent Markov chains MCMC queries run in parallel.
+		/// The samples are split between the chains.  The default is one.  This
+		/// is a shortcut for setting num_chains in the query options.
+		void set_num_chains(int num_chains);
+
+		/// Returns the number of Markov chains MCMC queries run
+		int get_num_chains() const;
+
+		/** Keeps the results of up to the given number of queries, so that
+		 * repeating a query with the same evidence, nodes, mode and options
+		 * returns the stored answer.  Sampled answers are then reused rather
+		 * than drawn again.  The cache is emptied whenever the network changes.
+		 * Zero, the default, turns caching off.
+		 */
+		void set_cache_size(size_t entries);
+
+		/// Returns the number of query results the network keeps
+		size_t get_cache_size() const;
+
+		/// Selects the precision in which compiled networks store their
+		/// probability tables, one of the PRECISION_* constants.  The default
+		/// is double precision.
+		void set_precision(int precision) throw(runtime_error);
+
+		/// Returns the precision in which the tables are stored
+		int get_precision() const;
+
+		/** Turns log-domain arithmetic on or off.
+		 *
+		 * In the log domain the samplers add the logs of table entries instead
+		 * of multiplying the entries, and the exact engines rescale their
+		 * factors as they go, so that nodes with many children or tiny
+		 * probabilities don't end up with weights of zero.  The compiled network
+		 * then keeps a log table next to every probability table.  It is off by
+		 * default.
+		 */
+		void set_log_domain(bool log_domain);
+
+		/// Tells whether queries run in the log domain
+		bool is_log_domain() const;
+
+		/// Seeds the generator that the sampling methods draw from, making the
+		/// results of the queries that follow reproducible.  Networks are seeded
+		/// from the clock and process id when they are created.
+		void set_seed(unsigned long long seed);
+
+		/** Freezes the current nodes into an index-based model.
+		 *
+		 * Queries compile the network automatically, and the compiled model is
+		 * reused until a node is added or any node in the network changes, so
+		 * calling this explicitly is only needed to pay the compilation cost up
+		 * front or to hold on to the model itself.
+		 */
+		shared_ptr<const CompiledNet> compile() throw(runtime_error);
+
+		/** Compiles the network and writes it to a model file.
+		 *
+		 * CompiledNet::load() maps the file back in without rebuilding the
+		 * nodes, and a QueryContext created on the loaded model answers queries
+		 * just like the network would.
+		 */
+		void save(const string& filename) throw(runtime_error);
+
+		/** Reads nodes from a file in one of the FORMAT_* formats, picked by
+		 * the extension: .bif, .xml or .xmlbif, or .net.
+		 *
+		 * The nodes are added to the network, which owns them, and the title is
+		 * taken from the file if it names the network.  Each table is built
+		 * directly in its dense layout as it is read, without going through
+		 * set_probability().  Only discrete chance nodes are supported.  Nothing
+		 * is added if the file has an error or defines a node the network
+		 * already has.
+		 */
+		void read(const string& filename) throw(runtime_error);
+
+		/// Same as read(), from a stream in the given format
+		void read(std::istream& in, int format) throw(runtime_error);
+
+		/// Writes the network to a file, picking the format by the extension
+		/// like read() does
+		void write(const string& filename) throw(runtime_error);
+
+		/// Same as write(), to a stream in the given format
+		void write(std::ostream& out, int format) throw(runtime_error);
+
+		/** Estimates every node's conditional probability table from a file
+		 * of observations, replacing the tables that were set.
+		 *
+		 * The file is read as described for DataReader, and the counts are
+		 * collected on the network's thread pool by a ParameterLearner.  With
+		 * a prior of zero the tables are maximum likelihood estimates;
+		 * otherwise the prior is added to every count, as in
+		 * ParameterLearner::get_table().
+		 */
+		void learn_parameters(const string& filename, double prior = 0)
+			throw(runtime_error);
+
+		/// Same as learn_parameters(), from a stream
+		void learn_parameters(std::istream& in, double prior = 0)
+			throw(runtime_error);
+
+		/** Fits every node's conditional probability table to a file of
+		 * observations with missing values, by expectation maximization.
+		 *
+		 * Starting from the tables that are set, each iteration reads the whole
+		 * file, adds up the expected counts of its rows on the network's thread
+		 * pool (see ParameterLearner::add_expected()) and replaces the tables
+		 * with the estimates from those counts, until no entry changes by more
+		 * than the tolerance or the iterations run out.  Every row must have a
+		 * nonzero probability under the starting tables, and nodes that are
+		 * never observed need tables that tell their states apart.  Returns the
+		 * number of iterations run.
+		 */
+		int learn_parameters_em(const string& filename, double prior = 0,
+		                        int max_iterations = 100,
+		                        double tolerance = 1e-4) throw(runtime_error);
+
+		/// Same as learn_parameters_em(), from a stream that can be rewound
+		int learn_parameters_em(std::istream& in, double prior = 0,
+		                        int max_iterations = 100,
+		                        double tolerance = 1e-4) throw(runtime_error);
+
+		/** Replaces the links between the nodes with those that best explain a
+		 * file of observations, then fits the tables to it.
+		 *
+		 * The whole file is read into memory and searched as described for
+		 * StructureLearner, starting from the current links.  The tables are
+		 * then estimated from the same data as learn_parameters() would, with
+		 * the given prior.
+		 */
+		void learn_structure(const string& filename, double prior = 0,
+		                     const StructureOptions& options = StructureOptions())
+			throw(runtime_error);
+
+		/// Same as learn_structure(), from a stream
+		void learn_structure(std::istream& in, double prior = 0,
+		                     const StructureOptions& options = StructureOptions())
+			throw(runtime_error);
+
 	private:
-		Event generate_random_event();
+		unsigned long get_revision() const;
+		QueryContext& get_context() throw(runtime_error);
 
-		static int m_count;
+		static std::atomic<int> m_count;
 
 		string m_title;
 		NodeMap m_nodes;
+
+		// nodes created by read(); the others belong to the caller
+		vector< shared_ptr<Node> > m_owned_nodes;
 		Event m_evidence;
+		shared_ptr<const CompiledNet> m_compiled;
+		unsigned long m_compiled_revision;
+		int m_precision;
+		bool m_log_domain;
+
+		// context for the network's own queries, switched to m_compiled when
+		// the network is recompiled
+		QueryContext m_context;
+
+		QueryOptions m_options;
+		QueryCache m_cache;
+		shared_ptr<ThreadPool> m_thread_pool;
 	};
 
 
@@ -0,0 +1,941 @@
+/*
+ * compilednet.cpp - Implementation of sbn::CompiledNet class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+#include <fstream>
+#include <cstring>
+#include <stdint.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+namespace sbn
+{
+
+	namespace
+	{
+
+		const char MODEL_MAGIC[8] = { 'S', 'B', 'N', 'M', 'O', 'D', 'E', 'L' };
+		const uint32_t MODEL_VERSION = 1;
+		const uint32_t MODEL_BYTE_ORDER = 0x01020304;
+
+		// the tables start on a cache line, so they are aligned when mapped
+		const uint64_t MODEL_ALIGNMENT = 64;
+
+		// The names and links follow the header as length-prefixed strings and
+		// counts, then come the tables at tables_offset.
+		struct ModelHeader
+		{
+			char magic[8];
+			uint32_t version;
+			uint32_t byte_order;
+			uint32_t precision;
+			uint32_t log_domain;
+			uint64_t num_nodes;
+			uint64_t num_entries;
+			uint64_t tables_offset;
+			uint64_t file_size;
+		};
+
+
+		void put(string& buffer, uint32_t value)
+		{
+			buffer.append(reinterpret_cast<const char *>(&value), sizeof(value));
+		}
+
+
+		void put(string& buffer, const string& value)
+		{
+			put(buffer, (uint32_t)value.size());
+			buffer.append(value);
+		}
+
+
+		// Reads back what put() wrote, making sure not to run past the end
+		class ModelReader
+		{
+		public:
+			ModelReader(const char *begin, const char *end) : m_pos(begin), m_end(end)
+			{
+			}
+
+			uint32_t get_int() throw(runtime_error)
+			{
+				uint32_t returnval;
+				if ((size_t)(m_end - m_pos) < sizeof(returnval))
+					throw runtime_error("Model file is corrupt");
+				memcpy(&returnval, m_pos, sizeof(returnval));
+				m_pos += sizeof(returnval);
+				return returnval;
+			}
+
+			string get_string() throw(runtime_error)
+			{
+				uint32_t size = get_int();
+				if ((size_t)(m_end - m_pos) < size)
+					throw runtime_error("Model file is corrupt");
+				string returnval(m_pos, size);
+				m_pos += size;
+				return returnval;
+			}
+
+		private:
+			const char *m_pos;
+			const char *m_end;
+		};
+
+
+		// zeroed heap memory for the tables of a model being built
+		shared_ptr<void> allocate_tables(size_t size)
+		{
+			void *tables = calloc(size > 0 ? size : 1, 1);
+			if (!tables) throw std::bad_alloc();
+			return shared_ptr<void>(tables, free);
+		}
+
+	}
+
+
+	CompiledNet::CompiledNet()
+		: m_precision(PRECISION_DOUBLE), m_log_domain(false), m_num_entries(0),
+		  m_cpt(0), m_cpt_float(0), m_log_cpt(0), m_log_cpt_float(0)
+	{
+	}
+
+
+	CompiledNet::CompiledNet(const NodeMap& nodes, int precision, bool log_domain)
+		throw(runtime_error)
+		: m_precision(precision), m_log_domain(log_domain), m_num_entries(0),
+		  m_cpt(0), m_cpt_float(0), m_log_cpt(0), m_log_cpt_float(0)
+	{
+		if (precision != PRECISION_DOUBLE && precision != PRECISION_FLOAT)
+			throw runtime_error("Invalid precision");
+
+		map<const Node*, int> pointer_ids;
+		NodeMap::const_iterator iter;
+		NodeVector::const_iterator link;
+		int id = 0;
+
+		for (iter = nodes.begin(); iter != nodes.end(); ++iter, ++id)
+		{
+			pointer_ids[iter->second] = id;
+			m_names.intern(iter->first);
+			m_states.push_back(iter->second->m_states);
+			if (iter->second->m_states.empty())
+				throw runtime_error("Encountered stateless node");
+		}
+
+		// translate parent and child pointers into ids
+		m_parents.resize(m_names.size());
+		m_children.resize(m_names.size());
+		for (iter = nodes.begin(), id = 0; iter != nodes.end(); ++iter, ++id)
+		{
+			const Node *node = iter->second;
+			for (link = node->m_parents.begin(); link != node->m_parents.end(); ++link)
+			{
+				map<const Node*, int>::iterator found = pointer_ids.find(*link);
+				if (found == pointer_ids.end())
+					throw runtime_error("Node has a parent outside the network");
+				m_parents[id].push_back(found->second);
+			}
+
+			// children that were never added to the network play no part in it
+			for (link = node->m_children.begin(); link != node->m_children.end(); ++link)
+			{
+				map<const Node*, int>::iterator found = pointer_ids.find(*link);
+				if (found != pointer_ids.end()) m_children[id].push_back(found->second);
+			}
+		}
+
+		layout();
+		set_tables(allocate_tables(get_tables_size()));
+
+		// the nodes already keep their tables in this layout
+		for (iter = nodes.begin(), id = 0; iter != nodes.end(); ++iter, ++id)
+		{
+			const vector<double>& table = iter->second->get_probabilities();
+			for (size_t i = 0; i < table.size(); ++i)
+			{
+				set_entry(m_cpt_offsets[id] + i, table[i]);
+			}
+		}
+	}
+
+
+	// Orders the nodes topologically and lays out (but doesn't fill in) the
+	// conditional probability tables, once the nodes, states and links are known.
+	void CompiledNet::layout() throw(runtime_error)
+	{
+		// topological order (Kahn's algorithm, lowest id first)
+		vector<int> pending(m_names.size());
+		vector<int> ready;
+		int id;
+		for (id = 0; id < num_nodes(); ++id)
+		{
+			pending[id] = m_parents[id].size();
+			if (pending[id] == 0) ready.push_back(id);
+		}
+		for (size_t i = 0; i < ready.size(); ++i)
+		{
+			m_order.push_back(ready[i]);
+			const vector<int>& children = m_children[ready[i]];
+			for (size_t c = 0; c < children.size(); ++c)
+			{
+				if (--pending[children[c]] == 0) ready.push_back(children[c]);
+			}
+		}
+		if ((int)m_order.size() != num_nodes())
+			throw runtime_error("Network contains a cycle");
+
+		// lay out the conditional probability tables
+		m_cpt_offsets.resize(m_names.size());
+		m_state_strides.resize(m_names.size());
+		m_parent_strides.resize(m_names.size());
+		int offset = 0;
+		for (id = 0; id < num_nodes(); ++id)
+		{
+			int stride = 1;
+			const vector<int>& parents = m_parents[id];
+			m_parent_strides[id].resize(parents.size());
+			for (int p = parents.size() - 1; p >= 0; --p)
+			{
+				m_parent_strides[id][p] = stride;
+				stride *= get_num_states(parents[p]);
+			}
+			m_state_strides[id] = stride;
+			m_cpt_offsets[id] = offset;
+			offset += stride * get_num_states(id);
+		}
+		m_num_entries = offset;
+
+		// where each node sits in its children's tables
+		m_child_strides.resize(m_names.size());
+		for (id = 0; id < num_nodes(); ++id)
+		{
+			const vector<int>& children = m_children[id];
+			m_child_strides[id].resize(children.size());
+			for (size_t c = 0; c < children.size(); ++c)
+			{
+				const vector<int>& parents = m_parents[children[c]];
+				size_t p = find(parents.begin(), parents.end(), id) - parents.begin();
+				m_child_strides[id][c] = m_parent_strides[children[c]][p];
+			}
+		}
+	}
+
+
+	size_t CompiledNet::get_tables_size() const
+	{
+		size_t entry = m_precision == PRECISION_FLOAT ? sizeof(float) : sizeof(double);
+		return m_num_entries * entry * (m_log_domain ? 2 : 1);
+	}
+
+
+	// the log tables, if any, follow the tables in the same block
+	void CompiledNet::set_tables(shared_ptr<void> tables)
+	{
+		m_tables = tables;
+		m_cpt = m_log_cpt = 0;
+		m_cpt_float = m_log_cpt_float = 0;
+		if (m_precision == PRECISION_FLOAT)
+		{
+			m_cpt_float = static_cast<float *>(tables.get());
+			if (m_log_domain) m_log_cpt_float = m_cpt_float + m_num_entries;
+		}
+		else
+		{
+			m_cpt = static_cast<double *>(tables.get());
+			if (m_log_domain) m_log_cpt = m_cpt + m_num_entries;
+		}
+	}
+
+
+	int CompiledNet::get_precision() const
+	{
+		return m_precision;
+	}
+
+
+	bool CompiledNet::is_log_domain() const
+	{
+		return m_log_domain;
+	}
+
+
+	int CompiledNet::num_nodes() const
+	{
+		return m_names.size();
+	}
+
+
+	int CompiledNet::get_node_id(const string& nodename) const
+		throw(runtime_error)
+	{
+		int id = m_names.find(nodename);
+		if (id < 0) throw runtime_error("Invalid node");
+		return id;
+	}
+
+
+	const string& CompiledNet::get_node_name(int id) const
+	{
+		return m_names.get_name(id);
+	}
+
+
+	int CompiledNet::get_num_states(int id) const
+	{
+		return m_states[id].size();
+	}
+
+
+	int CompiledNet::get_state_index(int id, const string& state) const
+		throw(runtime_error)
+	{
+		int index = m_states[id].find(state);
+		if (index < 0) throw runtime_error("Event contains invalid state");
+		return index;
+	}
+
+
+	const string& CompiledNet::get_state_name(int id, int state) const
+	{
+		return m_states[id].get_name(state);
+	}
+
+
+	const vector<int>& CompiledNet::get_parents(int id) const
+	{
+		return m_parents[id];
+	}
+
+
+	const vector<int>& CompiledNet::get_children(int id) const
+	{
+		return m_children[id];
+	}
+
+
+	const vector<int>& CompiledNet::get_topological_order() const
+	{
+		return m_order;
+	}
+
+
+	Assignment CompiledNet::to_assignment(const Event& event) const
+		throw(runtime_error)
+	{
+		Assignment returnval(num_nodes(), STATE_UNSET);
+		for (ObservationMap::const_iterator iter = event.m_observations.begin();
+		     iter != event.m_observations.end();
+		     ++iter)
+		{
+			int id = get_node_id(iter->first);
+			returnval[id] = get_state_index(id, iter->second);
+		}
+		return returnval;
+	}
+
+
+	Event CompiledNet::to_event(const Assignment& assignment) const
+	{
+		Event returnval;
+		for (int id = 0; id < num_nodes(); ++id)
+		{
+			if (assignment[id] != STATE_UNSET)
+				returnval.set_node(m_names.get_name(id), m_states[id].get_name(assignment[id]));
+		}
+		return returnval;
+	}
+
+
+	int CompiledNet::get_row_offset(int id, const Assignment& assignment) const
+	{
+		int offset = m_cpt_offsets[id];
+		const vector<int>& parents = m_parents[id];
+		const vector<int>& strides = m_parent_strides[id];
+		for (size_t p = 0; p < parents.size(); ++p)
+		{
+			offset += assignment[parents[p]] * strides[p];
+		}
+		return offset;
+	}
+
+
+	double CompiledNet::get_entry(int index) const
+	{
+		if (m_precision == PRECISION_FLOAT) return m_cpt_float[index];
+		return m_cpt[index];
+	}
+
+
+	void CompiledNet::set_entry(int index, double value)
+	{
+		if (m_precision == PRECISION_FLOAT) m_cpt_float[index] = value;
+		else m_cpt[index] = value;
+
+		if (m_log_domain && m_precision == PRECISION_FLOAT)
+			m_log_cpt_float[index] = std::log(m_cpt_float[index]);
+		else if (m_log_domain) m_log_cpt[index] = std::log(value);
+	}
+
+
+	double CompiledNet::get_probability(int id, int state,
+	                                    const Assignment& assignment) const
+	{
+		return get_entry(get_row_offset(id, assignment) + state * m_state_strides[id]);
+	}
+
+
+	double CompiledNet::get_log_probability(int id, int state,
+	                                        const Assignment& assignment) const
+	{
+		int index = get_row_offset(id, assignment) + state * m_state_strides[id];
+		if (!m_log_domain) return std::log(get_entry(index));
+		if (m_precision == PRECISION_FLOAT) return m_log_cpt_float[index];
+		return m_log_cpt[index];
+	}
+
+
+	Factor CompiledNet::get_factor(int id) const
+	{
+		vector<int> variables(1, id);
+		variables.insert(variables.end(), m_parents[id].begin(), m_parents[id].end());
+		vector<int> cardinalities;
+		for (size_t v = 0; v < variables.size(); ++v)
+		{
+			cardinalities.push_back(get_num_states(variables[v]));
+		}
+
+		Factor returnval(variables, cardinalities);
+		vector<double>& values = returnval.get_values();
+		if (m_precision == PRECISION_FLOAT)
+		{
+			const float *start = m_cpt_float + m_cpt_offsets[id];
+			copy(start, start + values.size(), values.begin());
+		}
+		else
+		{
+			const double *start = m_cpt + m_cpt_offsets[id];
+			copy(start, start + values.size(), values.begin());
+		}
+		return returnval;
+	}
+
+
+	vector< set<int> > CompiledNet::get_moral_graph(const Assignment& evidence) const
+	{
+		int n = num_nodes();
+		vector< set<int> > returnval(n);
+
+		// each node's unobserved family becomes a clique
+		for (int id = 0; id < n; ++id)
+		{
+			vector<int> family(1, id);
+			family.insert(family.end(), m_parents[id].begin(), m_parents[id].end());
+			for (size_t i = 0; i < family.size(); ++i)
+			{
+				if (evidence[family[i]] != STATE_UNSET) continue;
+				for (size_t j = i + 1; j < family.size(); ++j)
+				{
+					if (evidence[family[j]] != STATE_UNSET) continue;
+					if (family[i] == family[j]) continue;
+					returnval[family[i]].insert(family[j]);
+					returnval[family[j]].insert(family[i]);
+				}
+			}
+		}
+
+		return returnval;
+	}
+
+
+	vector<int> CompiledNet::get_elimination_order(const Assignment& evidence,
+	                                               const vector<int>& keep,
+	                                               int heuristic) const
+	{
+		int n = num_nodes();
+		vector< set<int> > graph = get_moral_graph(evidence);
+		vector<bool> eliminated(n, false);
+		int id;
+
+		int remaining = 0;
+		for (id = 0; id < n; ++id)
+		{
+			if (evidence[id] != STATE_UNSET) eliminated[id] = true;
+			else remaining++;
+		}
+		for (size_t k = 0; k < keep.size(); ++k)
+		{
+			if (!eliminated[keep[k]]) remaining--;
+			eliminated[keep[k]] = true;
+		}
+
+		vector<int> returnval;
+		while (remaining-- > 0)
+		{
+			int best = -1;
+			long best_fill = 0;
+			long best_degree = 0;
+			for (id = 0; id < n; ++id)
+			{
+				if (eliminated[id]) continue;
+				long degree = graph[id].size();
+				long fill = 0;
+				if (heuristic == ELIMINATION_MIN_FILL)
+				{
+					set<int>::iterator i, j;
+					for (i = graph[id].begin(); i != graph[id].end(); ++i)
+					{
+						for (j = i, ++j; j != graph[id].end(); ++j)
+						{
+							if (!graph[*i].count(*j)) fill++;
+						}
+					}
+				}
+				if (best < 0 || fill < best_fill ||
+				    (fill == best_fill && degree < best_degree))
+				{
+					best = id;
+					best_fill = fill;
+					best_degree = degree;
+				}
+			}
+
+			// connect the neighbours and take the variable out of the graph
+			set<int>::iterator i, j;
+			for (i = graph[best].begin(); i != graph[best].end(); ++i)
+			{
+				for (j = graph[best].begin(); j != graph[best].end(); ++j)
+				{
+					if (*i != *j) graph[*i].insert(*j);
+				}
+				graph[*i].erase(best);
+			}
+			graph[best].clear();
+			eliminated[best] = true;
+			returnval.push_back(best);
+		}
+
+		return returnval;
+	}
+
+
+	// In order to draw uniformly from the probabilty space, we can't just pick
+	// a random state.  Instead we generate a random number between zero and one
+	// and walk through the states until the cumulative sum of their
+	// probabilities exceeds our random number.
+	int CompiledNet::sample_state(int id, const Assignment& assignment,
+	                              RandomEngine& rng) const
+	{
+		if (m_precision == PRECISION_FLOAT)
+			return sample_state(m_cpt_float, id, assignment, rng);
+		return sample_state(m_cpt, id, assignment, rng);
+	}
+
+
+	template <class T>
+	int CompiledNet::sample_state(const T *cpt, int id, const Assignment& assignment,
+	                              RandomEngine& rng) const
+	{
+		double num = rng.next_double();
+		double sum = 0.0;
+		const T *row = cpt + get_row_offset(id, assignment);
+		int num_states = get_num_states(id);
+		int stride = m_state_strides[id];
+		int state;
+
+		for (state = 0; state < num_states - 1; ++state)
+		{
+			sum += row[state * stride];
+			if (num < sum) break;
+		}
+		return state;
+	}
+
+
+	void CompiledNet::sample_forward(Assignment& assignment,
+	                                 RandomEngine& rng) const
+	{
+		for (vector<int>::const_iterator iter = m_order.begin();
+		     iter != m_order.end();
+		     ++iter)
+		{
+			if (assignment[*iter] == STATE_UNSET)
+				assignment[*iter] = sample_state(*iter, assignment, rng);
+		}
+	}
+
+
+	// In the log domain the weights are sums of logs.  The largest one is
+	// subtracted before they are turned back into probabilities, so that the
+	// most likely state always gets a weight of one, however small the
+	// products would have been.
+	int CompiledNet::sample_markov_blanket(int id, const Assignment& assignment,
+	                                       RandomEngine& rng,
+	                                       vector<double>& weights) const
+	{
+		int num_states = get_num_states(id);
+		int state;
+
+		weights.resize(num_states);
+		if (m_log_domain)
+		{
+			if (m_precision == PRECISION_FLOAT)
+				get_blanket_weights(m_log_cpt_float, id, assignment, weights);
+			else get_blanket_weights(m_log_cpt, id, assignment, weights);
+
+			double largest = *max_element(weights.begin(), weights.end());
+			for (state = 0; state < num_states; ++state)
+			{
+				weights[state] = largest == -HUGE_VAL ? 0.0 :
+					std::exp(weights[state] - largest);
+			}
+		}
+		else if (m_precision == PRECISION_FLOAT)
+			get_blanket_weights(m_cpt_float, id, assignment, weights);
+		else get_blanket_weights(m_cpt, id, assignment, weights);
+
+		double magnitude = 0.0;
+		for (state = 0; state < num_states; ++state) magnitude += weights[state];
+
+		double num = magnitude * rng.next_double();
+		double sum = 0.0;
+		for (state = 0; state < num_states - 1; ++state)
+		{
+			sum += weights[state];
+			if (num < sum) break;
+		}
+		return state;
+	}
+
+
+	// The node is temporarily set to each of its states in turn so that the
+	// children's tables can be looked up with the candidate state in place.
+	// Only the rows that depend on the node change with its state, so each
+	// child's row is located once with the node's digit taken out, and the
+	// states are then reached by stepping through the row by the precomputed
+	// stride.  The entries are multiplied, or added if they are logs.
+	template <class T>
+	void CompiledNet::get_blanket_weights(const T *cpt, int id,
+	                                      const Assignment& assignment,
+	                                      vector<double>& weights) const
+	{
+		int num_states = get_num_states(id);
+		const vector<int>& children = m_children[id];
+		const vector<int>& strides = m_child_strides[id];
+		int state;
+
+		const T *row = cpt + get_row_offset(id, assignment);
+		int stride = m_state_strides[id];
+		for (state = 0; state < num_states; ++state)
+		{
+			weights[state] = row[state * stride];
+		}
+
+		for (size_t c = 0; c < children.size(); ++c)
+		{
+			int child = children[c];
+			stride = strides[c];
+			row = cpt + get_row_offset(child, assignment) +
+			      assignment[child] * m_state_strides[child] -
+			      assignment[id] * stride;
+			for (state = 0; state < num_states; ++state)
+			{
+				if (m_log_domain) weights[state] += row[state * stride];
+				else weights[state] *= row[state * stride];
+			}
+		}
+	}
+
+
+	// Bayes ball (Shachter 1998).  A ball bounced from the query nodes marks
+	// the "top" of every node whose table can change the answer and visits
+	// every observed node whose value can.  Unobserved nodes pass a ball from a
+	// child on to both parents and children, and a ball from a parent on to
+	// the children; observed nodes only bounce a ball from a parent back up.
+	void CompiledNet::get_requisite_nodes(const vector<int>& ids,
+	                                      const Assignment& evidence,
+	                                      vector<bool>& tables,
+	                                      vector<bool>& observations) const
+	{
+		vector<bool> bottom(num_nodes(), false);
+		vector< std::pair<int, bool> > schedule;
+		tables.assign(num_nodes(), false);
+		observations.assign(num_nodes(), false);
+
+		// each entry is a node and whether the ball comes from one of its children
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			schedule.push_back(std::make_pair(ids[i], true));
+		}
+		while (!schedule.empty())
+		{
+			int id = schedule.back().first;
+			bool from_child = schedule.back().second;
+			bool observed = evidence[id] != STATE_UNSET;
+			schedule.pop_back();
+
+			if (observed) observations[id] = true;
+			bool up = !tables[id] && (from_child ? !observed : observed);
+			bool down = !bottom[id] && !observed;
+			if (up)
+			{
+				tables[id] = true;
+				for (size_t p = 0; p < m_parents[id].size(); ++p)
+				{
+					schedule.push_back(std::make_pair(m_parents[id][p], true));
+				}
+			}
+			if (down)
+			{
+				bottom[id] = true;
+				for (size_t c = 0; c < m_children[id].size(); ++c)
+				{
+					schedule.push_back(std::make_pair(m_children[id][c], false));
+				}
+			}
+		}
+	}
+
+
+	CompiledNet CompiledNet::prune(const vector<int>& ids,
+	                               const Assignment& evidence,
+	                               vector<int>& mapping) const
+	{
+		vector<bool> tables, observations;
+		get_requisite_nodes(ids, evidence, tables, observations);
+		for (size_t i = 0; i < ids.size(); ++i) observations[ids[i]] = true;
+
+		// the kept nodes stay in the same relative order, so names stay sorted
+		CompiledNet returnval;
+		returnval.m_precision = m_precision;
+		returnval.m_log_domain = m_log_domain;
+		mapping.assign(num_nodes(), -1);
+		for (int id = 0; id < num_nodes(); ++id)
+		{
+			if (!tables[id] && !observations[id]) continue;
+			mapping[id] = returnval.m_names.intern(m_names.get_name(id));
+			returnval.m_states.push_back(m_states[id]);
+		}
+
+		// a node whose table is needed has all of its parents kept as well
+		returnval.m_parents.resize(returnval.m_names.size());
+		returnval.m_children.resize(returnval.m_names.size());
+		for (int id = 0; id < num_nodes(); ++id)
+		{
+			if (mapping[id] < 0) continue;
+			for (size_t p = 0; tables[id] && p < m_parents[id].size(); ++p)
+			{
+				returnval.m_parents[mapping[id]].push_back(mapping[m_parents[id][p]]);
+			}
+			for (size_t c = 0; c < m_children[id].size(); ++c)
+			{
+				int child = m_children[id][c];
+				if (tables[child])
+					returnval.m_children[mapping[id]].push_back(mapping[child]);
+			}
+		}
+		returnval.layout();
+		returnval.set_tables(allocate_tables(returnval.get_tables_size()));
+
+		// Nodes that are only kept for their observed state become roots that
+		// are certain to be in it.  That only scales the joint distribution, so
+		// the posteriors don't change.
+		for (int id = 0; id < num_nodes(); ++id)
+		{
+			if (mapping[id] < 0) continue;
+			int table = returnval.m_cpt_offsets[mapping[id]];
+			if (tables[id])
+			{
+				int size = m_state_strides[id] * get_num_states(id);
+				for (int i = 0; i < size; ++i)
+				{
+					returnval.set_entry(table + i, get_entry(m_cpt_offsets[id] + i));
+				}
+			}
+			else
+			{
+				for (int state = 0; state < get_num_states(id); ++state)
+				{
+					returnval.set_entry(table + state, state == evidence[id] ? 1.0 : 0.0);
+				}
+			}
+		}
+
+		return returnval;
+	}
+
+
+	void CompiledNet::save(const string& filename) const throw(runtime_error)
+	{
+		string metadata;
+		int id;
+		for (id = 0; id < num_nodes(); ++id)
+		{
+			put(metadata, m_names.get_name(id));
+			put(metadata, (uint32_t)get_num_states(id));
+			for (int state = 0; state < get_num_states(id); ++state)
+			{
+				put(metadata, m_states[id].get_name(state));
+			}
+		}
+		for (id = 0; id < num_nodes(); ++id)
+		{
+			put(metadata, (uint32_t)m_parents[id].size());
+			for (size_t p = 0; p < m_parents[id].size(); ++p)
+			{
+				put(metadata, (uint32_t)m_parents[id][p]);
+			}
+			put(metadata, (uint32_t)m_children[id].size());
+			for (size_t c = 0; c < m_children[id].size(); ++c)
+			{
+				put(metadata, (uint32_t)m_children[id][c]);
+			}
+		}
+
+		ModelHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, MODEL_MAGIC, sizeof(header.magic));
+		header.version = MODEL_VERSION;
+		header.byte_order = MODEL_BYTE_ORDER;
+		header.precision = m_precision;
+		header.log_domain = m_log_domain;
+		header.num_nodes = num_nodes();
+		header.num_entries = m_num_entries;
+		uint64_t end = sizeof(header) + metadata.size();
+		header.tables_offset = (end + MODEL_ALIGNMENT - 1) / MODEL_ALIGNMENT * MODEL_ALIGNMENT;
+		header.file_size = header.tables_offset + get_tables_size();
+
+		std::ofstream file(filename.c_str(), std::ios::binary | std::ios::trunc);
+		if (!file) throw runtime_error("Unable to open " + filename);
+		file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+		file.write(metadata.data(), metadata.size());
+		file.write(string(header.tables_offset - end, '\0').data(), header.tables_offset - end);
+		file.write(static_cast<const char *>(m_tables.get()), get_tables_size());
+		file.close();
+		if (!file) throw runtime_error("Unable to write " + filename);
+	}
+
+
+	shared_ptr<const CompiledNet> CompiledNet::load(const string& filename)
+		throw(runtime_error)
+	{
+		int fd = open(filename.c_str(), O_RDONLY);
+		if (fd < 0) throw runtime_error("Unable to open " + filename);
+		struct stat info;
+		if (fstat(fd, &info) < 0 || info.st_size < (off_t)sizeof(ModelHeader))
+		{
+			close(fd);
+			throw runtime_error("Not a model file");
+		}
+		size_t size = info.st_size;
+		void *address = mmap(0, size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (address == MAP_FAILED) throw runtime_error("Unable to map " + filename);
+		shared_ptr<void> mapping(address, [size](void *p) { munmap(p, size); });
+
+		char *base = static_cast<char *>(address);
+		ModelHeader header;
+		memcpy(&header, base, sizeof(header));
+		if (memcmp(header.magic, MODEL_MAGIC, sizeof(header.magic)) != 0)
+			throw runtime_error("Not a model file");
+		if (header.byte_order != MODEL_BYTE_ORDER)
+			throw runtime_error("Model file has the wrong byte order");
+		if (header.version != MODEL_VERSION)
+			throw runtime_error("Unsupported model file version");
+		if (header.file_size != size || header.tables_offset > size ||
+		    header.tables_offset % MODEL_ALIGNMENT != 0 ||
+		    (header.precision != PRECISION_DOUBLE && header.precision != PRECISION_FLOAT))
+			throw runtime_error("Model file is corrupt");
+
+		shared_ptr<CompiledNet> returnval(new CompiledNet());
+		returnval->m_precision = header.precision;
+		returnval->m_log_domain = header.log_domain != 0;
+		ModelReader reader(base + sizeof(header), base + header.tables_offset);
+		uint64_t id;
+		for (id = 0; id < header.num_nodes; ++id)
+		{
+			if (returnval->m_names.intern(reader.get_string()) != (int)id)
+				throw runtime_error("Model file is corrupt");
+			SymbolTable states;
+			uint32_t num_states = reader.get_int();
+			for (uint32_t state = 0; state < num_states; ++state)
+			{
+				states.intern(reader.get_string());
+			}
+			if (num_states == 0 || states.size() != (int)num_states)
+				throw runtime_error("Model file is corrupt");
+			returnval->m_states.push_back(states);
+		}
+
+		returnval->m_parents.resize(header.num_nodes);
+		returnval->m_children.resize(header.num_nodes);
+		for (id = 0; id < header.num_nodes; ++id)
+		{
+			for (int link = 0; link < 2; ++link)
+			{
+				vector<int>& links = link == 0 ? returnval->m_parents[id] :
+				                                 returnval->m_children[id];
+				uint32_t count = reader.get_int();
+				for (uint32_t i = 0; i < count; ++i)
+				{
+					uint32_t other = reader.get_int();
+					if (other >= header.num_nodes) throw runtime_error("Model file is corrupt");
+					links.push_back(other);
+				}
+			}
+		}
+
+		// layout() looks each node up among its children's parents, so the two
+		// lists have to mirror each other exactly
+		for (id = 0; id < header.num_nodes; ++id)
+		{
+			const vector<int>& parents = returnval->m_parents[id];
+			const vector<int>& children = returnval->m_children[id];
+			for (size_t p = 0; p < parents.size(); ++p)
+			{
+				const vector<int>& siblings = returnval->m_children[parents[p]];
+				if (parents[p] == (int)id ||
+				    count(parents.begin(), parents.end(), parents[p]) != 1 ||
+				    count(siblings.begin(), siblings.end(), (int)id) != 1)
+					throw runtime_error("Model file is corrupt");
+			}
+			for (size_t c = 0; c < children.size(); ++c)
+			{
+				const vector<int>& coparents = returnval->m_parents[children[c]];
+				if (count(children.begin(), children.end(), children[c]) != 1 ||
+				    count(coparents.begin(), coparents.end(), (int)id) != 1)
+					throw runtime_error("Model file is corrupt");
+			}
+		}
+
+		returnval->layout();
+		if (returnval->m_num_entries != header.num_entries ||
+		    header.tables_offset + returnval->get_tables_size() != size)
+			throw runtime_error("Model file is corrupt");
+		returnval->set_tables(shared_ptr<void>(mapping, base + header.tables_offset));
+		return returnval;
+	}
+
+}
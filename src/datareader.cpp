@@ -0,0 +1,276 @@
+/*
+ * datareader.cpp - Implementation of sbn::DataReader class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+
+#include "sbn.h"
+#include <cstring>
+#include <sstream>
+
+
+namespace sbn
+{
+
+	namespace
+	{
+
+		/** Splits the next field off a line.
+		 *
+		 * Sets [begin, end) to the field with the blanks around it and any
+		 * enclosing quotes removed, and returns where the next field starts, or
+		 * eol after the last one.  A quoted field with doubled quotes in it is
+		 * unescaped into scratch, and the range then points there.
+		 */
+		const char *next_field(const char *pos, const char *eol, const char *&begin,
+		                       const char *&end, string& scratch)
+		{
+			while (pos < eol && (*pos == ' ' || *pos == '\t')) ++pos;
+			if (pos < eol && *pos == '"')
+			{
+				begin = ++pos;
+				while (pos < eol && !(*pos == '"' && (pos + 1 == eol || pos[1] != '"')))
+				{
+					pos += *pos == '"' ? 2 : 1;
+				}
+				end = pos;
+				if (memchr(begin, '"', end - begin))
+				{
+					scratch.clear();
+					for (const char *c = begin; c < end; ++c)
+					{
+						scratch += *c;
+						if (*c == '"') ++c;
+					}
+					begin = scratch.data();
+					end = begin + scratch.size();
+				}
+				if (pos < eol) ++pos;
+				while (pos < eol && *pos != ',') ++pos;
+			}
+			else
+			{
+				begin = pos;
+				while (pos < eol && *pos != ',') ++pos;
+				end = pos;
+				while (end > begin && (end[-1] == ' ' || end[-1] == '\t')) --end;
+			}
+			return pos < eol ? pos + 1 : eol;
+		}
+
+
+		// Returns the end of a line, leaving out the carriage return of a DOS
+		// line ending
+		const char *line_end(const char *begin, const char *end)
+		{
+			const char *eol = (const char *)memchr(begin, '\n', end - begin);
+			if (!eol) eol = end;
+			if (eol > begin && eol[-1] == '\r') --eol;
+			return eol;
+		}
+
+
+		string error(long line, const string& message)
+		{
+			std::ostringstream returnval;
+			returnval << "Data file, line " << line << ": " << message;
+			return returnval.str();
+		}
+
+	}
+
+
+	DataReader::DataReader(std::istream& in, shared_ptr<const CompiledNet> model)
+		throw(runtime_error)
+		: m_in(in), m_model(model), m_line(2)
+	{
+		string header;
+		if (!std::getline(m_in, header)) throw runtime_error("Data file is empty");
+
+		string scratch;
+		const char *pos = header.data();
+		const char *eol = line_end(pos, pos + header.size());
+		set<int> seen;
+		while (true)
+		{
+			const char *begin, *end;
+			pos = next_field(pos, eol, begin, end, scratch);
+			string name(begin, end);
+			int id;
+			try
+			{
+				id = m_model->get_node_id(name);
+			}
+			catch (runtime_error&)
+			{
+				throw runtime_error(error(1, "unknown node '" + name + "'"));
+			}
+			if (!seen.insert(id).second)
+				throw runtime_error(error(1, "node '" + name + "' appears twice"));
+
+			m_nodes.push_back(id);
+			m_states.push_back(SymbolTable());
+			for (int s = 0; s < m_model->get_num_states(id); ++s)
+			{
+				m_states.back().intern(m_model->get_state_name(id, s));
+			}
+			if (pos == eol) break;
+		}
+	}
+
+
+	const vector<int>& DataReader::get_nodes() const
+	{
+		return m_nodes;
+	}
+
+
+	// Blocks end after the last complete line read so far; the partial line
+	// after it is kept for the next block.  A line longer than the block size
+	// makes the block grow until the line is complete.
+	bool DataReader::next_block(string& text, long& line, size_t size)
+		throw(runtime_error)
+	{
+		text.swap(m_rest);
+		m_rest.clear();
+		size_t newline = string::npos;
+		while (m_in)
+		{
+			size_t start = text.size();
+			text.resize(start + size);
+			m_in.read(&text[start], size);
+			text.resize(start + m_in.gcount());
+			newline = text.rfind('\n');
+			if (newline != string::npos) break;
+		}
+		if (m_in.bad()) throw runtime_error("Error reading data file");
+
+		if (m_in && newline != string::npos)
+		{
+			m_rest.assign(text, newline + 1, string::npos);
+			text.resize(newline + 1);
+		}
+		if (text.empty()) return false;
+
+		line = m_line;
+		m_line += std::count(text.begin(), text.end(), '\n');
+		return true;
+	}
+
+
+	void DataReader::parse(const string& text, long line, EvidenceBatch& batch) const
+		throw(runtime_error)
+	{
+		batch.nodes = m_nodes;
+		batch.columns.resize(m_nodes.size());
+		for (size_t c = 0; c < m_nodes.size(); ++c) batch.columns[c].clear();
+
+		string scratch;
+		const char *pos = text.data();
+		const char *end = pos + text.size();
+		for (; pos < end; ++line)
+		{
+			const char *eol = line_end(pos, end);
+			const char *next = eol < end && *eol == '\r' ? eol + 2 : eol + 1;
+			const char *blank = pos;
+			while (blank < eol && (*blank == ' ' || *blank == '\t')) ++blank;
+			if (blank == eol)
+			{
+				pos = next;
+				continue;
+			}
+
+			size_t column = 0;
+			while (true)
+			{
+				const char *begin, *field_end;
+				pos = next_field(pos, eol, begin, field_end, scratch);
+				if (column == m_nodes.size())
+					throw runtime_error(error(line, "too many fields"));
+
+				int state;
+				if (!find_state(column, begin, field_end, scratch, state))
+				{
+					int id = m_nodes[column];
+					throw runtime_error(error(line, "'" + string(begin, field_end) +
+					                          "' is not a state of node " +
+					                          m_model->get_node_name(id)));
+				}
+				batch.columns[column++].push_back(state);
+				if (pos == eol) break;
+			}
+			if (column < m_nodes.size())
+				throw runtime_error(error(line, "too few fields"));
+			pos = next;
+		}
+	}
+
+
+	void DataReader::read(EvidenceBatch& batch) throw(runtime_error)
+	{
+		batch.nodes = m_nodes;
+		batch.columns.assign(m_nodes.size(), vector<int>());
+
+		string text;
+		long line;
+		EvidenceBatch block;
+		while (next_block(text, line))
+		{
+			parse(text, line, block);
+			for (size_t c = 0; c < m_nodes.size(); ++c)
+			{
+				batch.columns[c].insert(batch.columns[c].end(),
+				                        block.columns[c].begin(), block.columns[c].end());
+			}
+		}
+	}
+
+
+	// Sets state to the state index of a field, or STATE_UNSET for a missing
+	// value, and returns false if the node has no such state.  Most nodes have
+	// only a few states, so comparing against each of them is quicker than
+	// hashing the field.
+	bool DataReader::find_state(int column, const char *begin, const char *end,
+	                            string& scratch, int& state) const
+	{
+		size_t length = end - begin;
+		state = STATE_UNSET;
+		if (length == 0 || (length == 1 && *begin == '?')) return true;
+
+		const SymbolTable& states = m_states[column];
+		if (states.size() > 8)
+		{
+			if (begin != scratch.data()) scratch.assign(begin, length);
+			state = states.find(scratch);
+			return state >= 0;
+		}
+		for (int s = 0; s < states.size(); ++s)
+		{
+			const string& name = states.get_name(s);
+			if (name.size() == length && std::memcmp(name.data(), begin, length) == 0)
+			{
+				state = s;
+				return true;
+			}
+		}
+		return false;
+	}
+
+}
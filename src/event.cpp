@@ -26,14 +26,24 @@
 namespace sbn
 {
 
-	Event::Event() { }
-	Event::Event(const Event& event) { *this = event; }
+	Event::Event() : m_string_current(false), m_hash(0), m_hash_current(false)
+	{
+	}
+
+
+	Event::Event(const Event& event)
+		: m_string_current(false), m_hash(0), m_hash_current(false)
+	{
+		*this = event;
+	}
+
+
 	Event& Event::operator=(const Event& event)
 	{
 		if (this != &event)
 		{
 			m_observations = event.m_observations;
-			generate_string_representation();
+			invalidate();
 		}
 		return *this;
 	}
@@ -41,14 +51,41 @@ namespace sbn
 
 	bool Event::operator<(const Event& event) const
 	{
-		return m_string_representation < event.m_string_representation;
+		return m_observations < event.m_observations;
 	}
 
 
-	void Event::generate_string_representation()
+	bool Event::operator==(const Event& event) const
+	{
+		if (m_hash_current && event.m_hash_current && m_hash != event.m_hash)
+			return false;
+		return m_observations == event.m_observations;
+	}
+
+
+	size_t Event::hash() const
+	{
+		if (m_hash_current) return m_hash;
+
+		std::hash<string> hash_string;
+		size_t returnval = 0;
+		for (ObservationMap::const_iterator iter = m_observations.begin();
+		     iter != m_observations.end();
+		     ++iter)
+		{
+			returnval = returnval * 31 + hash_string(iter->first);
+			returnval = returnval * 31 + hash_string(iter->second);
+		}
+		m_hash = returnval;
+		m_hash_current = true;
+		return m_hash;
+	}
+
+
+	void Event::generate_string_representation() const
 	{
 		m_string_representation = "";
-		for (ObservationMap::iterator iter = m_observations.begin();
+		for (ObservationMap::const_iterator iter = m_observations.begin();
 		     iter != m_observations.end();
 		     ++iter)
 		{
@@ -56,35 +93,48 @@ namespace sbn
 				m_string_representation += ", ";
 			m_string_representation += iter->first + " = " + iter->second;
 		}
+		m_string_current = true;
+	}
+
+
+	// The cached string and hash are only rebuilt when they are asked for, so
+	// changing an event costs no more than the map update itself.
+	void Event::invalidate()
+	{
+		m_string_current = false;
+		m_hash_current = false;
 	}
-	
+
 
 	// for pretty printing
-	Event::operator const char *()
+	Event::operator const char *() const
 	{
+		if (!m_string_current) generate_string_representation();
 		return m_string_representation.c_str();
 	}
 
 
-	string Event::get_node_state(const string& nodename) throw(runtime_error)
+	string Event::get_node_state(const string& nodename) const
+		throw(runtime_error)
 	{
-		ObservationMap::iterator iter = m_observations.find(nodename);
+		ObservationMap::const_iterator iter = m_observations.find(nodename);
 		if (iter == m_observations.end()) throw runtime_error("Invalid node");
 		return iter->second;
 	}
 
 
-	bool Event::has_node(const string& nodename)
+	bool Event::has_node(const string& nodename) const
 	{
-		ObservationMap::iterator iter = m_observations.find(nodename);
+		ObservationMap::const_iterator iter = m_observations.find(nodename);
 		if (iter != m_observations.end()) return true;
 		return false;
 	}
 
 
-	bool Event::node_has_state(const string& nodename, const string& state)
+	bool Event::node_has_state(const string& nodename,
+	                           const string& state) const
 	{
-		ObservationMap::iterator iter = m_observations.find(nodename);
+		ObservationMap::const_iterator iter = m_observations.find(nodename);
 		if (iter != m_observations.end())
 		{
 			if (iter->second == state) return true;
@@ -96,7 +146,7 @@ namespace sbn
 	void Event::set_node(const string& nodename, const string& state)
 	{
 		m_observations[nodename] = state;
-		generate_string_representation();
+		invalidate();
 	}
 
 
@@ -106,20 +156,22 @@ namespace sbn
 		if (iter != m_observations.end())
 		{
 			m_observations.erase(iter);
+			invalidate();
 		}
-		generate_string_representation();
 	}
 
 
 	void Event::clear()
 	{
 		m_observations.clear();
-		generate_string_representation();
+		invalidate();
 	}
 
 
+	// the caller may change the observations, so the caches can't be trusted
 	ObservationMap& Event::get_observations()
 	{
+		invalidate();
 		return m_observations;
 	}
 
@@ -0,0 +1,72 @@
+/*
+ * evidencebatch.cpp - Implementation of sbn::EvidenceBatch struct
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	int EvidenceBatch::num_rows() const
+	{
+		return columns.empty() ? 0 : columns[0].size();
+	}
+
+
+	void EvidenceBatch::get_row(int row, Assignment& evidence) const
+	{
+		for (size_t c = 0; c < nodes.size(); ++c)
+		{
+			evidence[nodes[c]] = columns[c][row];
+		}
+	}
+
+
+	void EvidenceBatch::validate(const CompiledNet& model) const
+		throw(runtime_error)
+	{
+		if (columns.size() != nodes.size())
+			throw runtime_error("Evidence batch needs one column per node");
+
+		set<int> seen;
+		int rows = num_rows();
+		for (size_t c = 0; c < nodes.size(); ++c)
+		{
+			int id = nodes[c];
+			if (id < 0 || id >= model.num_nodes())
+				throw runtime_error("Invalid node id in evidence batch");
+			if (!seen.insert(id).second)
+				throw runtime_error("Node appears twice in evidence batch");
+			if ((int)columns[c].size() != rows)
+				throw runtime_error("Evidence batch columns differ in length");
+
+			int num_states = model.get_num_states(id);
+			for (int r = 0; r < rows; ++r)
+			{
+				int state = columns[c][r];
+				if (state != STATE_UNSET && (state < 0 || state >= num_states))
+					throw runtime_error("Invalid state index in evidence batch");
+			}
+		}
+	}
+
+}
@@ -0,0 +1,347 @@
+/*
+ * factor.cpp - Implementation of sbn::Factor class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	Factor::Factor() : m_values(1, 1.0) { }
+
+
+	Factor::Factor(const vector<int>& variables, const vector<int>& cardinalities)
+		: m_variables(variables), m_cardinalities(cardinalities)
+	{
+		compute_strides();
+	}
+
+
+	void Factor::compute_strides()
+	{
+		size_t size = 1;
+		m_strides.resize(m_variables.size());
+		for (int i = m_variables.size() - 1; i >= 0; --i)
+		{
+			m_strides[i] = size;
+			size *= m_cardinalities[i];
+		}
+		m_values.assign(size, 0.0);
+	}
+
+
+	const vector<int>& Factor::get_variables() const
+	{
+		return m_variables;
+	}
+
+
+	const vector<int>& Factor::get_cardinalities() const
+	{
+		return m_cardinalities;
+	}
+
+
+	bool Factor::has_variable(int variable) const
+	{
+		return find(m_variables.begin(), m_variables.end(), variable) !=
+			m_variables.end();
+	}
+
+
+	size_t Factor::size() const
+	{
+		return m_values.size();
+	}
+
+
+	vector<double>& Factor::get_values()
+	{
+		return m_values;
+	}
+
+
+	const vector<double>& Factor::get_values() const
+	{
+		return m_values;
+	}
+
+
+	int Factor::find_variable(int variable) const throw(runtime_error)
+	{
+		vector<int>::const_iterator iter =
+			find(m_variables.begin(), m_variables.end(), variable);
+		if (iter == m_variables.end())
+			throw runtime_error("Variable is not part of the factor");
+		return iter - m_variables.begin();
+	}
+
+
+	Factor Factor::product(const Factor& factor) const
+	{
+		return combine(factor, false);
+	}
+
+
+	Factor Factor::divide(const Factor& factor) const
+	{
+		return combine(factor, true);
+	}
+
+
+	// Walks the entries of the result in order, keeping track of the matching
+	// entry in each operand.  A variable that is missing from an operand gets a
+	// stride of zero there, so the operand's index simply doesn't move with it.
+	//
+	// The trailing variables over which each operand either moves in step with
+	// the result or doesn't move at all are handled as one run by the kernels;
+	// the counter only walks the variables in front of them.  In the common
+	// case, where the other factor's variables all come from this one in the
+	// same order, the run covers most of the table.
+	Factor Factor::combine(const Factor& factor, bool quotient) const
+	{
+		vector<int> variables = m_variables;
+		vector<int> cardinalities = m_cardinalities;
+		size_t i;
+
+		for (i = 0; i < factor.m_variables.size(); ++i)
+		{
+			if (!has_variable(factor.m_variables[i]))
+			{
+				variables.push_back(factor.m_variables[i]);
+				cardinalities.push_back(factor.m_cardinalities[i]);
+			}
+		}
+
+		Factor returnval(variables, cardinalities);
+		int num_variables = variables.size();
+		vector<int> left_strides(num_variables, 0);
+		vector<int> right_strides(num_variables, 0);
+		vector<int> counter(num_variables, 0);
+		for (int v = 0; v < num_variables; ++v)
+		{
+			if (v < (int)m_variables.size()) left_strides[v] = m_strides[v];
+			vector<int>::const_iterator found = find(factor.m_variables.begin(),
+			                                         factor.m_variables.end(),
+			                                         variables[v]);
+			if (found != factor.m_variables.end())
+				right_strides[v] = factor.m_strides[found - factor.m_variables.begin()];
+		}
+
+		// find the run: each operand must be contiguous over all of it, or fixed
+		int split = num_variables;
+		size_t run = 1;
+		bool left_moves = true, right_moves = true;
+		while (split > 0)
+		{
+			int v = split - 1;
+			bool left_step = left_strides[v] != 0, right_step = right_strides[v] != 0;
+			if ((left_step && left_strides[v] != (int)run) ||
+			    (right_step && right_strides[v] != (int)run))
+				break;
+			if (split < num_variables &&
+			    (left_step != left_moves || right_step != right_moves))
+				break;
+			left_moves = left_step;
+			right_moves = right_step;
+			run *= cardinalities[v];
+			split = v;
+		}
+
+		const double *a = &m_values[0], *b = &factor.m_values[0];
+		size_t left = 0, right = 0;
+		for (i = 0; i < returnval.m_values.size(); i += run)
+		{
+			double *out = &returnval.m_values[i];
+			if (run == 1)
+			{
+				if (!quotient) *out = a[left] * b[right];
+				else if (b[right] != 0.0) *out = a[left] / b[right];
+			}
+			else if (left_moves && right_moves)
+			{
+				if (!quotient) kernels::multiply(out, a + left, b + right, run);
+				else kernels::divide(out, a + left, b + right, run);
+			}
+			else if (left_moves)
+			{
+				if (!quotient) kernels::multiply(out, a + left, b[right], run);
+				else kernels::divide(out, a + left, b[right], run);
+			}
+			else
+			{
+				if (!quotient) kernels::multiply(out, b + right, a[left], run);
+				else kernels::divide(out, a[left], b + right, run);
+			}
+
+			// advance the counter, least significant variable first
+			for (int v = split - 1; v >= 0; --v)
+			{
+				if (++counter[v] < cardinalities[v])
+				{
+					left += left_strides[v];
+					right += right_strides[v];
+					break;
+				}
+				counter[v] = 0;
+				left -= (cardinalities[v] - 1) * left_strides[v];
+				right -= (cardinalities[v] - 1) * right_strides[v];
+			}
+		}
+
+		return returnval;
+	}
+
+
+	// An entry's index splits into the digits before the variable (outer), the
+	// variable itself, and the digits after it (inner), which are contiguous.
+	Factor Factor::sum_out(int variable) const throw(runtime_error)
+	{
+		int position = find_variable(variable);
+		vector<int> variables = m_variables;
+		vector<int> cardinalities = m_cardinalities;
+		variables.erase(variables.begin() + position);
+		cardinalities.erase(cardinalities.begin() + position);
+
+		Factor returnval(variables, cardinalities);
+		size_t inner = m_strides[position];
+		size_t states = m_cardinalities[position];
+		size_t outer = m_values.size() / (inner * states);
+
+		for (size_t o = 0; o < outer; ++o)
+		{
+			double *target = &returnval.m_values[o * inner];
+			if (inner == 1)
+			{
+				*target = kernels::sum(&m_values[o * states], states);
+				continue;
+			}
+			for (size_t s = 0; s < states; ++s)
+			{
+				kernels::add(target, &m_values[(o * states + s) * inner], inner);
+			}
+		}
+
+		return returnval;
+	}
+
+
+	// Same loops as sum_out(), starting each slice from the variable's first
+	// state instead of from zero.
+	Factor Factor::max_out(int variable) const throw(runtime_error)
+	{
+		int position = find_variable(variable);
+		vector<int> variables = m_variables;
+		vector<int> cardinalities = m_cardinalities;
+		variables.erase(variables.begin() + position);
+		cardinalities.erase(cardinalities.begin() + position);
+
+		Factor returnval(variables, cardinalities);
+		size_t inner = m_strides[position];
+		size_t states = m_cardinalities[position];
+		size_t outer = m_values.size() / (inner * states);
+
+		for (size_t o = 0; o < outer; ++o)
+		{
+			double *target = &returnval.m_values[o * inner];
+			const double *slice = &m_values[o * states * inner];
+			if (inner == 1)
+			{
+				*target = *std::max_element(slice, slice + states);
+				continue;
+			}
+			std::copy(slice, slice + inner, target);
+			for (size_t s = 1; s < states; ++s)
+			{
+				kernels::maximum(target, slice + s * inner, inner);
+			}
+		}
+
+		return returnval;
+	}
+
+
+	Factor Factor::marginal(const vector<int>& variables) const
+	{
+		Factor returnval = *this;
+		for (size_t v = 0; v < m_variables.size(); ++v)
+		{
+			if (find(variables.begin(), variables.end(), m_variables[v]) ==
+			    variables.end())
+				returnval = returnval.sum_out(m_variables[v]);
+		}
+		return returnval;
+	}
+
+
+	Factor Factor::reduce(int variable, int state) const throw(runtime_error)
+	{
+		int position = find_variable(variable);
+		vector<int> variables = m_variables;
+		vector<int> cardinalities = m_cardinalities;
+		variables.erase(variables.begin() + position);
+		cardinalities.erase(cardinalities.begin() + position);
+
+		Factor returnval(variables, cardinalities);
+		size_t inner = m_strides[position];
+		size_t states = m_cardinalities[position];
+		size_t outer = m_values.size() / (inner * states);
+
+		for (size_t o = 0; o < outer; ++o)
+		{
+			copy(m_values.begin() + (o * states + state) * inner,
+			     m_values.begin() + (o * states + state + 1) * inner,
+			     returnval.m_values.begin() + o * inner);
+		}
+
+		return returnval;
+	}
+
+
+	void Factor::set_evidence(int variable, int state) throw(runtime_error)
+	{
+		int position = find_variable(variable);
+		size_t inner = m_strides[position];
+		size_t states = m_cardinalities[position];
+		size_t outer = m_values.size() / (inner * states);
+
+		for (size_t o = 0; o < outer; ++o)
+		{
+			for (size_t s = 0; s < states; ++s)
+			{
+				if ((int)s == state) continue;
+				fill(m_values.begin() + (o * states + s) * inner,
+				     m_values.begin() + (o * states + s + 1) * inner,
+				     0.0);
+			}
+		}
+	}
+
+
+	double Factor::normalize()
+	{
+		double magnitude = kernels::sum(&m_values[0], m_values.size());
+		if (magnitude > 0.0) kernels::scale(&m_values[0], 1.0 / magnitude, m_values.size());
+		return magnitude;
+	}
+
+}
@@ -0,0 +1,158 @@
+/*
+ * forwardsampler.cpp - Implementation of sbn::ForwardSampler class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	ForwardSampler::ForwardSampler(const CompiledNet& model) : m_model(model)
+	{
+	}
+
+
+	vector< vector<double> > ForwardSampler::rejection_sampling(const vector<int>& ids,
+	                                                            const Assignment& evidence,
+	                                                            const QueryOptions& options,
+	                                                            RandomEngine& rng) const
+		throw(runtime_error)
+	{
+		const vector<int>& order = m_model.get_topological_order();
+		vector< vector<double> > returnval;
+		Assignment sample(m_model.num_nodes());
+		int accepted = 0;
+		std::chrono::steady_clock::time_point deadline = options.get_deadline();
+		bool limited = deadline != std::chrono::steady_clock::time_point::max();
+
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			returnval.push_back(vector<double>(m_model.get_num_states(ids[i]), 0.0));
+		}
+
+		for (int i = 0; i < options.num_samples; ++i)
+		{
+			if (limited && i > 0 && std::chrono::steady_clock::now() >= deadline) break;
+
+			// a sample can be thrown away as soon as it contradicts the evidence
+			bool consistent = true;
+			for (size_t n = 0; n < order.size() && consistent; ++n)
+			{
+				int node = order[n];
+				sample[node] = m_model.sample_state(node, sample, rng);
+				if (evidence[node] != STATE_UNSET && evidence[node] != sample[node])
+					consistent = false;
+			}
+			if (!consistent) continue;
+
+			for (size_t n = 0; n < ids.size(); ++n) returnval[n][sample[ids[n]]]++;
+			accepted++;
+		}
+
+		if (accepted == 0)
+			throw runtime_error("No samples were consistent with the evidence");
+		for (size_t n = 0; n < returnval.size(); ++n)
+		{
+			for (size_t s = 0; s < returnval[n].size(); ++s)
+			{
+				returnval[n][s] /= accepted;
+			}
+		}
+		return returnval;
+	}
+
+
+	// In the log domain each sample's weight is a sum of logs, and the tallies
+	// are kept relative to the largest weight seen so far.  When a sample beats
+	// it, the tallies are scaled down to the new reference instead, so that a
+	// weight far below the smallest double still counts.
+	vector< vector<double> > ForwardSampler::likelihood_weighting(const vector<int>& ids,
+	                                                              const Assignment& evidence,
+	                                                              const QueryOptions& options,
+	                                                              RandomEngine& rng) const
+		throw(runtime_error)
+	{
+		const vector<int>& order = m_model.get_topological_order();
+		vector< vector<double> > returnval;
+		Assignment sample = evidence;
+		double magnitude = 0.0;
+		double reference = -HUGE_VAL;
+		bool log_domain = m_model.is_log_domain();
+		std::chrono::steady_clock::time_point deadline = options.get_deadline();
+		bool limited = deadline != std::chrono::steady_clock::time_point::max();
+
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			returnval.push_back(vector<double>(m_model.get_num_states(ids[i]), 0.0));
+		}
+
+		for (int i = 0; i < options.num_samples; ++i)
+		{
+			if (limited && i > 0 && std::chrono::steady_clock::now() >= deadline) break;
+
+			double weight = log_domain ? 0.0 : 1.0;
+			for (size_t n = 0; n < order.size(); ++n)
+			{
+				int node = order[n];
+				if (evidence[node] == STATE_UNSET)
+					sample[node] = m_model.sample_state(node, sample, rng);
+				else if (log_domain)
+					weight += m_model.get_log_probability(node, evidence[node], sample);
+				else weight *= m_model.get_probability(node, evidence[node], sample);
+			}
+
+			if (log_domain)
+			{
+				if (weight == -HUGE_VAL) continue;
+				if (weight > reference)
+				{
+					double rescale = std::exp(reference - weight);
+					for (size_t n = 0; n < returnval.size(); ++n)
+					{
+						for (size_t s = 0; s < returnval[n].size(); ++s)
+						{
+							returnval[n][s] *= rescale;
+						}
+					}
+					magnitude *= rescale;
+					reference = weight;
+				}
+				weight = std::exp(weight - reference);
+			}
+
+			for (size_t n = 0; n < ids.size(); ++n) returnval[n][sample[ids[n]]] += weight;
+			magnitude += weight;
+		}
+
+		if (magnitude <= 0.0)
+			throw runtime_error("No samples were consistent with the evidence");
+		for (size_t n = 0; n < returnval.size(); ++n)
+		{
+			for (size_t s = 0; s < returnval[n].size(); ++s)
+			{
+				returnval[n][s] /= magnitude;
+			}
+		}
+		return returnval;
+	}
+
+}
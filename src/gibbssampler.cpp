@@ -0,0 +1,180 @@
+/*
+ * gibbssampler.cpp - Implementation of sbn::GibbsSampler class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	GibbsSampler::GibbsSampler(const CompiledNet& model) : m_model(model)
+	{
+	}
+
+
+	/** Runs a Markov chain and counts the states the node visits.  The MCMC
+	 * algorithm generates each event by making a random change to the preceding
+	 * event.  The next state is generated by randomly sampling a value for one
+	 * of the nonevidence variables Xi, conditioned on the current values of the
+	 * variables in the Markov blanket of Xi.  MCMC basically wanders randomly
+	 * around the state space--the space of possible complete assignments--
+	 * flipping one variable at a time, but keeping the evidence variables fixed.
+	 * The sampling process works because it settles into a "dynamic
+	 * equilibrium" in which the long-run fraction of time spent in each state is
+	 * exactly proportional to its posterior probability.
+	 */
+	vector< vector<int> > GibbsSampler::run_chain(const vector<int>& ids,
+	                                              const Assignment& evidence,
+	                                              const QueryOptions& options,
+	                                              int num_samples,
+	                                              std::chrono::steady_clock::time_point deadline,
+	                                              RandomEngine& rng,
+	                                              Assignment& state) const
+	{
+		typedef std::chrono::steady_clock Clock;
+		bool limited = deadline != Clock::time_point::max();
+		int num_nodes = m_model.num_nodes();
+		int thinning = options.thinning > 1 ? options.thinning : 1;
+		int sweeps = options.burn_in > 0 ? options.burn_in : 0;
+		int counted = 0;
+		vector<double> weights;
+		vector< vector<int> > returnval;
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			returnval.push_back(vector<int>(m_model.get_num_states(ids[i]), 0));
+		}
+
+		if ((int)state.size() != num_nodes) state.assign(num_nodes, STATE_UNSET);
+		for (int node = 0; node < num_nodes; ++node)
+		{
+			if (evidence[node] != STATE_UNSET) state[node] = evidence[node];
+		}
+		m_model.sample_forward(state, rng);
+		while (counted < num_samples)
+		{
+			if (sweeps == 0)
+			{
+				for (size_t i = 0; i < ids.size(); ++i) returnval[i][state[ids[i]]]++;
+				counted++;
+				sweeps = thinning;
+				continue;
+			}
+
+			// out of time: keep what we have, but never return an empty count
+			if (limited && Clock::now() >= deadline)
+			{
+				if (counted == 0)
+				{
+					for (size_t i = 0; i < ids.size(); ++i) returnval[i][state[ids[i]]]++;
+				}
+				break;
+			}
+
+			for (int node = 0; node < num_nodes; ++node)
+			{
+				// nodes that are set in the evidence stay fixed
+				if (evidence[node] != STATE_UNSET) continue;
+				state[node] = m_model.sample_markov_blanket(node, state, rng, weights);
+			}
+			sweeps--;
+		}
+
+		return returnval;
+	}
+
+
+	vector< vector<double> > GibbsSampler::query(const vector<int>& ids,
+	                                             const Assignment& evidence,
+	                                             const QueryOptions& options,
+	                                             RandomEngine& rng,
+	                                             Assignment& state) const
+	{
+		return normalize(run_chain(ids, evidence, options, options.num_samples,
+		                           options.get_deadline(), rng, state));
+	}
+
+
+	// The samples are split evenly between the chains.  Each chain gets its own
+	// stream, split off the caller's generator, and its own chain state, so the
+	// chains share nothing but the read-only model until their counts are added.
+	// Since the streams are handed out before the chains start, the result does
+	// not depend on how the chains are scheduled (unless there is a time limit).
+	vector< vector<double> > GibbsSampler::query(const vector<int>& ids,
+	                                             const Assignment& evidence,
+	                                             const QueryOptions& options,
+	                                             ThreadPool& pool,
+	                                             RandomEngine& rng,
+	                                             vector<Assignment>& states) const
+	{
+		int num_chains = options.num_chains > 1 ? options.num_chains : 1;
+		states.resize(num_chains);
+		if (num_chains == 1) return query(ids, evidence, options, rng, states[0]);
+
+		std::chrono::steady_clock::time_point deadline = options.get_deadline();
+		vector<RandomEngine> streams;
+		vector< vector< vector<int> > > frequencies(num_chains);
+		for (int c = 0; c < num_chains; ++c) streams.push_back(rng.split());
+
+		ThreadPool::Task task = [&](int chain, int)
+		{
+			int samples = options.num_samples / num_chains +
+				(chain < options.num_samples % num_chains ? 1 : 0);
+			frequencies[chain] = run_chain(ids, evidence, options, samples, deadline,
+			                               streams[chain], states[chain]);
+		};
+		pool.run(num_chains, task);
+
+		vector< vector<int> > total = frequencies[0];
+		for (int c = 1; c < num_chains; ++c)
+		{
+			for (size_t i = 0; i < total.size(); ++i)
+			{
+				for (size_t s = 0; s < total[i].size(); ++s)
+				{
+					total[i][s] += frequencies[c][i][s];
+				}
+			}
+		}
+		return normalize(total);
+	}
+
+
+	vector< vector<double> > GibbsSampler::normalize(const vector< vector<int> >& frequencies)
+	{
+		vector< vector<double> > returnval(frequencies.size());
+		for (size_t i = 0; i < frequencies.size(); ++i)
+		{
+			int magnitude = 0;
+			for (size_t s = 0; s < frequencies[i].size(); ++s)
+			{
+				magnitude += frequencies[i][s];
+			}
+			for (size_t s = 0; s < frequencies[i].size(); ++s)
+			{
+				returnval[i].push_back(magnitude > 0 ?
+				                       frequencies[i][s] / (double)magnitude : 0.0);
+			}
+		}
+		return returnval;
+	}
+
+}
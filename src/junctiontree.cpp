@@ -0,0 +1,347 @@
+/*
+ * junctiontree.cpp - Implementation of sbn::JunctionTree class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	JunctionTree::JunctionTree(const CompiledNet& model, int heuristic)
+		: m_model(model), m_calibrated(false)
+	{
+		int n = model.num_nodes();
+		Assignment none(n, STATE_UNSET);
+		vector< set<int> > graph = model.get_moral_graph(none);
+		vector<int> order = model.get_elimination_order(none, vector<int>(), heuristic);
+
+		// Triangulate by replaying the elimination.  Each eliminated node forms a
+		// clique with its remaining neighbours; a clique can only be contained in
+		// one that was formed earlier, since later ones no longer include the node.
+		vector< set<int> > cliques;
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			int node = order[i];
+			set<int> clique = graph[node];
+			clique.insert(node);
+
+			bool maximal = true;
+			for (size_t c = 0; c < cliques.size() && maximal; ++c)
+			{
+				if (includes(cliques[c].begin(), cliques[c].end(),
+				             clique.begin(), clique.end()))
+					maximal = false;
+			}
+			if (maximal) cliques.push_back(clique);
+
+			set<int>::iterator a, b;
+			for (a = graph[node].begin(); a != graph[node].end(); ++a)
+			{
+				for (b = graph[node].begin(); b != graph[node].end(); ++b)
+				{
+					if (*a != *b) graph[*a].insert(*b);
+				}
+				graph[*a].erase(node);
+			}
+		}
+		for (size_t c = 0; c < cliques.size(); ++c)
+		{
+			m_cliques.push_back(vector<int>(cliques[c].begin(), cliques[c].end()));
+		}
+
+		// Join the cliques into a maximum spanning tree over separator sizes
+		// (Prim's algorithm).  Disconnected parts of the network are joined by
+		// empty separators.
+		int num = m_cliques.size();
+		vector<bool> in_tree(num, false);
+		vector<int> weight(num, -1);
+		m_parents.assign(num, -1);
+		for (int step = 0; step < num; ++step)
+		{
+			int best = -1;
+			for (int c = 0; c < num; ++c)
+			{
+				if (!in_tree[c] && (best < 0 || weight[c] > weight[best])) best = c;
+			}
+			in_tree[best] = true;
+			m_order.push_back(best);
+
+			for (int c = 0; c < num; ++c)
+			{
+				if (in_tree[c]) continue;
+				vector<int> common;
+				set_intersection(cliques[best].begin(), cliques[best].end(),
+				                 cliques[c].begin(), cliques[c].end(),
+				                 back_inserter(common));
+				if ((int)common.size() > weight[c])
+				{
+					weight[c] = common.size();
+					m_parents[c] = best;
+				}
+			}
+		}
+
+		m_children.assign(num, vector<int>());
+		for (int c = 0; c < num; ++c)
+		{
+			if (m_parents[c] >= 0) m_children[m_parents[c]].push_back(c);
+		}
+
+		// assign every table to the first clique that holds its whole family
+		m_node_cliques.assign(n, -1);
+		for (int id = 0; id < n; ++id)
+		{
+			set<int> family(model.get_parents(id).begin(), model.get_parents(id).end());
+			family.insert(id);
+			for (int c = 0; c < num && m_node_cliques[id] < 0; ++c)
+			{
+				if (includes(cliques[c].begin(), cliques[c].end(),
+				             family.begin(), family.end()))
+					m_node_cliques[id] = c;
+			}
+		}
+	}
+
+
+	int JunctionTree::num_cliques() const
+	{
+		return m_cliques.size();
+	}
+
+
+	const vector<int>& JunctionTree::get_clique(int clique) const
+	{
+		return m_cliques[clique];
+	}
+
+
+	// Findings that were added since the last calibration are multiplied into
+	// the calibrated potentials and propagated from there.  A finding that was
+	// retracted or changed can't be divided back out of a potential, so then
+	// the tree is loaded and propagated from scratch.
+	void JunctionTree::calibrate(const Assignment& evidence) throw(runtime_error)
+	{
+		if (m_calibrated && evidence == m_evidence) return;
+
+		bool incremental = m_calibrated;
+		set<int> changed;
+		for (size_t id = 0; incremental && id < evidence.size(); ++id)
+		{
+			if (evidence[id] == m_evidence[id]) continue;
+			if (m_evidence[id] != STATE_UNSET) incremental = false;
+			else changed.insert(m_node_cliques[id]);
+		}
+		m_calibrated = false;
+
+		if (incremental)
+		{
+			for (size_t id = 0; id < evidence.size(); ++id)
+			{
+				if (evidence[id] != m_evidence[id])
+					m_potentials[m_node_cliques[id]].set_evidence(id, evidence[id]);
+			}
+
+			// one changed clique only has to tell the others
+			if (changed.size() == 1) distribute(*changed.begin());
+			else propagate();
+		}
+		else
+		{
+			load(evidence);
+			propagate();
+		}
+
+		// all cliques now agree on the probability of the evidence
+		if (!m_potentials.empty())
+		{
+			double magnitude = 0.0;
+			const vector<double>& values = m_potentials[0].get_values();
+			for (size_t v = 0; v < values.size(); ++v) magnitude += values[v];
+			if (magnitude <= 0.0) throw runtime_error("Evidence has zero probability");
+		}
+
+		m_evidence = evidence;
+		m_calibrated = true;
+	}
+
+
+	// Loads the tables and the evidence into the clique potentials and resets
+	// the separators.
+	void JunctionTree::load(const Assignment& evidence)
+	{
+		int num = m_cliques.size();
+		m_potentials.clear();
+		m_separators.clear();
+		for (int c = 0; c < num; ++c)
+		{
+			vector<int> cardinalities;
+			for (size_t v = 0; v < m_cliques[c].size(); ++v)
+			{
+				cardinalities.push_back(m_model.get_num_states(m_cliques[c][v]));
+			}
+			Factor potential(m_cliques[c], cardinalities);
+			potential.get_values().assign(potential.size(), 1.0);
+			m_potentials.push_back(potential);
+
+			Factor separator;
+			if (m_parents[c] >= 0)
+			{
+				vector<int> common, separator_cardinalities;
+				set_intersection(m_cliques[c].begin(), m_cliques[c].end(),
+				                 m_cliques[m_parents[c]].begin(),
+				                 m_cliques[m_parents[c]].end(),
+				                 back_inserter(common));
+				for (size_t v = 0; v < common.size(); ++v)
+				{
+					separator_cardinalities.push_back(m_model.get_num_states(common[v]));
+				}
+				separator = Factor(common, separator_cardinalities);
+				separator.get_values().assign(separator.size(), 1.0);
+			}
+			m_separators.push_back(separator);
+		}
+		for (int id = 0; id < m_model.num_nodes(); ++id)
+		{
+			Factor& potential = m_potentials[m_node_cliques[id]];
+			potential = potential.product(m_model.get_factor(id));
+			if (evidence[id] != STATE_UNSET) potential.set_evidence(id, evidence[id]);
+			if (m_model.is_log_domain()) potential.normalize();
+		}
+
+	}
+
+
+	// Collects towards the root, then distributes back out.
+	void JunctionTree::propagate()
+	{
+		int num = m_cliques.size();
+		int i;
+		for (i = num - 1; i > 0; --i)
+		{
+			pass_message(m_order[i], m_parents[m_order[i]], m_order[i]);
+		}
+		for (i = 1; i < num; ++i)
+		{
+			pass_message(m_parents[m_order[i]], m_order[i], m_order[i]);
+		}
+	}
+
+
+	// Passes messages outwards from one clique to all the others, which is
+	// enough to recalibrate a calibrated tree after that clique has changed.
+	void JunctionTree::distribute(int clique)
+	{
+		vector<int> pending(1, clique);
+		vector<bool> visited(m_cliques.size(), false);
+		visited[clique] = true;
+		while (!pending.empty())
+		{
+			int from = pending.back();
+			pending.pop_back();
+
+			int parent = m_parents[from];
+			if (parent >= 0 && !visited[parent])
+			{
+				pass_message(from, parent, from);
+				visited[parent] = true;
+				pending.push_back(parent);
+			}
+			for (size_t c = 0; c < m_children[from].size(); ++c)
+			{
+				int child = m_children[from][c];
+				if (visited[child]) continue;
+				pass_message(from, child, child);
+				visited[child] = true;
+				pending.push_back(child);
+			}
+		}
+	}
+
+
+	// Hugin update: the receiving clique is multiplied by the ratio of the new
+	// separator marginal to the one that was last passed across it.  In the log
+	// domain messages and potentials are scaled to sum to one as they go, which
+	// leaves every clique proportional to what it would have been and keeps
+	// large cliques from underflowing.
+	void JunctionTree::pass_message(int from, int to, int separator)
+	{
+		Factor message = m_potentials[from].marginal(m_separators[separator].get_variables());
+		if (m_model.is_log_domain()) message.normalize();
+		m_potentials[to] = m_potentials[to].product(message.divide(m_separators[separator]));
+		if (m_model.is_log_domain()) m_potentials[to].normalize();
+		m_separators[separator] = message;
+	}
+
+
+	vector<double> JunctionTree::get_marginal(int id) const throw(runtime_error)
+	{
+		if (!m_calibrated) throw runtime_error("Junction tree is not calibrated");
+
+		// any clique containing the node will do
+		if (id < 0 || id >= (int)m_node_cliques.size())
+			throw runtime_error("Invalid node");
+		int clique = m_node_cliques[id];
+
+		Factor marginal = m_potentials[clique].marginal(vector<int>(1, id));
+		marginal.normalize();
+		return marginal.get_values();
+	}
+
+
+	// Multiplying a table of ones laid out like the node's table by the
+	// family's marginal puts the marginal in that layout.
+	vector<double> JunctionTree::get_family_marginal(int id) const
+		throw(runtime_error)
+	{
+		if (!m_calibrated) throw runtime_error("Junction tree is not calibrated");
+		if (id < 0 || id >= (int)m_node_cliques.size())
+			throw runtime_error("Invalid node");
+
+		vector<int> family(1, id);
+		const vector<int>& parents = m_model.get_parents(id);
+		family.insert(family.end(), parents.begin(), parents.end());
+		vector<int> cardinalities;
+		for (size_t v = 0; v < family.size(); ++v)
+		{
+			cardinalities.push_back(m_model.get_num_states(family[v]));
+		}
+		Factor table(family, cardinalities);
+		table.get_values().assign(table.size(), 1.0);
+
+		Factor marginal = table.product(m_potentials[m_node_cliques[id]].marginal(family));
+		marginal.normalize();
+		return marginal.get_values();
+	}
+
+
+	vector< vector<double> > JunctionTree::get_marginals() const
+		throw(runtime_error)
+	{
+		vector< vector<double> > returnval;
+		for (int id = 0; id < m_model.num_nodes(); ++id)
+		{
+			returnval.push_back(get_marginal(id));
+		}
+		return returnval;
+	}
+
+}
@@ -0,0 +1,503 @@
+/*
+ * kernels.cpp - Vectorized loops over dense tables
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SBN_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+
+// The loops are the same for every instruction set; only the vector type S::V
+// (S::width elements of T) and the operations on it differ.  They are stamped
+// out once per instruction set, inside that instruction set's target region,
+// because a function only gets the wider registers if it is compiled for them.
+// Whatever doesn't fill a whole vector is finished one element at a time.
+#define SBN_KERNEL_LOOPS \
+	template <class S, class T> \
+	void multiply(T *out, const T *a, const T *b, size_t n) \
+	{ \
+		size_t i = 0; \
+		for (; i + S::width <= n; i += S::width) \
+			S::store(out + i, S::mul(S::load(a + i), S::load(b + i))); \
+		for (; i < n; ++i) out[i] = a[i] * b[i]; \
+	} \
+	\
+	template <class S, class T> \
+	void multiply_scalar(T *out, const T *a, T b, size_t n) \
+	{ \
+		size_t i = 0; \
+		typename S::V factor = S::set1(b); \
+		for (; i + S::width <= n; i += S::width) \
+			S::store(out + i, S::mul(S::load(a + i), factor)); \
+		for (; i < n; ++i) out[i] = a[i] * b; \
+	} \
+	\
+	template <class S, class T> \
+	void divide(T *out, const T *a, const T *b, size_t n) \
+	{ \
+		size_t i = 0; \
+		for (; i + S::width <= n; i += S::width) \
+			S::store(out + i, S::div_or_zero(S::load(a + i), S::load(b + i))); \
+		for (; i < n; ++i) out[i] = b[i] != 0 ? a[i] / b[i] : 0; \
+	} \
+	\
+	template <class S, class T> \
+	void divide_scalar(T *out, const T *a, T b, size_t n) \
+	{ \
+		if (b == 0) \
+		{ \
+			std::fill(out, out + n, T(0)); \
+			return; \
+		} \
+		size_t i = 0; \
+		typename S::V divisor = S::set1(b); \
+		for (; i + S::width <= n; i += S::width) \
+			S::store(out + i, S::div(S::load(a + i), divisor)); \
+		for (; i < n; ++i) out[i] = a[i] / b; \
+	} \
+	\
+	template <class S, class T> \
+	void scalar_divide(T *out, T a, const T *b, size_t n) \
+	{ \
+		size_t i = 0; \
+		typename S::V dividend = S::set1(a); \
+		for (; i + S::width <= n; i += S::width) \
+			S::store(out + i, S::div_or_zero(dividend, S::load(b + i))); \
+		for (; i < n; ++i) out[i] = b[i] != 0 ? a / b[i] : 0; \
+	} \
+	\
+	template <class S, class T> \
+	void add(T *target, const T *source, size_t n) \
+	{ \
+		size_t i = 0; \
+		for (; i + S::width <= n; i += S::width) \
+			S::store(target + i, S::add(S::load(target + i), S::load(source + i))); \
+		for (; i < n; ++i) target[i] += source[i]; \
+	} \
+	\
+	template <class S, class T> \
+	void maximum(T *target, const T *source, size_t n) \
+	{ \
+		size_t i = 0; \
+		for (; i + S::width <= n; i += S::width) \
+			S::store(target + i, S::max(S::load(target + i), S::load(source + i))); \
+		for (; i < n; ++i) target[i] = std::max(target[i], source[i]); \
+	} \
+	\
+	template <class S, class T> \
+	T sum(const T *values, size_t n) \
+	{ \
+		size_t i = 0; \
+		typename S::V total = S::set1(0); \
+		for (; i + S::width <= n; i += S::width) \
+			total = S::add(total, S::load(values + i)); \
+		T returnval = S::reduce(total); \
+		for (; i < n; ++i) returnval += values[i]; \
+		return returnval; \
+	} \
+	\
+	template <class S, class T> \
+	void scale(T *values, T factor, size_t n) \
+	{ \
+		multiply_scalar<S, T>(values, values, factor, n); \
+	} \
+	\
+	template <class S, class T> \
+	KernelTable<T> make_table() \
+	{ \
+		KernelTable<T> returnval = { &multiply<S, T>, &multiply_scalar<S, T>, \
+		                             &divide<S, T>, &divide_scalar<S, T>, \
+		                             &scalar_divide<S, T>, &add<S, T>, \
+		                             &maximum<S, T>, &sum<S, T>, &scale<S, T> }; \
+		return returnval; \
+	}
+
+
+namespace sbn
+{
+
+	namespace
+	{
+
+		template <class T>
+		struct KernelTable
+		{
+			void (*multiply)(T *, const T *, const T *, size_t);
+			void (*multiply_scalar)(T *, const T *, T, size_t);
+			void (*divide)(T *, const T *, const T *, size_t);
+			void (*divide_scalar)(T *, const T *, T, size_t);
+			void (*scalar_divide)(T *, T, const T *, size_t);
+			void (*add)(T *, const T *, size_t);
+			void (*maximum)(T *, const T *, size_t);
+			T (*sum)(const T *, size_t);
+			void (*scale)(T *, T, size_t);
+		};
+
+
+		namespace scalar
+		{
+			// one element at a time, for processors without the vector units
+			template <class T>
+			struct Lanes
+			{
+				typedef T V;
+				enum { width = 1 };
+				static V load(const T *p) { return *p; }
+				static void store(T *p, V v) { *p = v; }
+				static V set1(T x) { return x; }
+				static V add(V a, V b) { return a + b; }
+				static V max(V a, V b) { return std::max(a, b); }
+				static V mul(V a, V b) { return a * b; }
+				static V div(V a, V b) { return a / b; }
+				static V div_or_zero(V a, V b) { return b != 0 ? a / b : 0; }
+				static T reduce(V v) { return v; }
+			};
+
+			SBN_KERNEL_LOOPS
+		}
+
+#ifdef SBN_X86_KERNELS
+#pragma GCC push_options
+#pragma GCC target("avx2")
+		namespace avx2
+		{
+			struct Double
+			{
+				typedef __m256d V;
+				enum { width = 4 };
+				static V load(const double *p) { return _mm256_loadu_pd(p); }
+				static void store(double *p, V v) { _mm256_storeu_pd(p, v); }
+				static V set1(double x) { return _mm256_set1_pd(x); }
+				static V add(V a, V b) { return _mm256_add_pd(a, b); }
+				static V max(V a, V b) { return _mm256_max_pd(a, b); }
+				static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+				static V div(V a, V b) { return _mm256_div_pd(a, b); }
+				static V div_or_zero(V a, V b)
+				{
+					V nonzero = _mm256_cmp_pd(b, _mm256_setzero_pd(), _CMP_NEQ_OQ);
+					return _mm256_and_pd(_mm256_div_pd(a, b), nonzero);
+				}
+				static double reduce(V v)
+				{
+					__m128d half = _mm_add_pd(_mm256_castpd256_pd128(v),
+					                          _mm256_extractf128_pd(v, 1));
+					return _mm_cvtsd_f64(_mm_add_sd(half, _mm_unpackhi_pd(half, half)));
+				}
+			};
+
+			struct Float
+			{
+				typedef __m256 V;
+				enum { width = 8 };
+				static V load(const float *p) { return _mm256_loadu_ps(p); }
+				static void store(float *p, V v) { _mm256_storeu_ps(p, v); }
+				static V set1(float x) { return _mm256_set1_ps(x); }
+				static V add(V a, V b) { return _mm256_add_ps(a, b); }
+				static V max(V a, V b) { return _mm256_max_ps(a, b); }
+				static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+				static V div(V a, V b) { return _mm256_div_ps(a, b); }
+				static V div_or_zero(V a, V b)
+				{
+					V nonzero = _mm256_cmp_ps(b, _mm256_setzero_ps(), _CMP_NEQ_OQ);
+					return _mm256_and_ps(_mm256_div_ps(a, b), nonzero);
+				}
+				static float reduce(V v)
+				{
+					__m128 half = _mm_add_ps(_mm256_castps256_ps128(v),
+					                         _mm256_extractf128_ps(v, 1));
+					half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+					return _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+				}
+			};
+
+			SBN_KERNEL_LOOPS
+		}
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+		namespace avx512
+		{
+			struct Double
+			{
+				typedef __m512d V;
+				enum { width = 8 };
+				static V load(const double *p) { return _mm512_loadu_pd(p); }
+				static void store(double *p, V v) { _mm512_storeu_pd(p, v); }
+				static V set1(double x) { return _mm512_set1_pd(x); }
+				static V add(V a, V b) { return _mm512_add_pd(a, b); }
+				static V max(V a, V b)
+				{
+					// the unmasked form passes an undefined vector through, which
+					// GCC 12 warns about
+					return _mm512_mask_max_pd(a, (__mmask8)-1, a, b);
+				}
+				static V mul(V a, V b) { return _mm512_mul_pd(a, b); }
+				static V div(V a, V b) { return _mm512_div_pd(a, b); }
+				static V div_or_zero(V a, V b)
+				{
+					__mmask8 nonzero = _mm512_cmp_pd_mask(b, _mm512_setzero_pd(), _CMP_NEQ_OQ);
+					return _mm512_maskz_div_pd(nonzero, a, b);
+				}
+				static double reduce(V v)
+				{
+					double lanes[width];
+					_mm512_storeu_pd(lanes, v);
+					return scalar::sum<scalar::Lanes<double>, double>(lanes, width);
+				}
+			};
+
+			struct Float
+			{
+				typedef __m512 V;
+				enum { width = 16 };
+				static V load(const float *p) { return _mm512_loadu_ps(p); }
+				static void store(float *p, V v) { _mm512_storeu_ps(p, v); }
+				static V set1(float x) { return _mm512_set1_ps(x); }
+				static V add(V a, V b) { return _mm512_add_ps(a, b); }
+				static V max(V a, V b)
+				{
+					return _mm512_mask_max_ps(a, (__mmask16)-1, a, b);
+				}
+				static V mul(V a, V b) { return _mm512_mul_ps(a, b); }
+				static V div(V a, V b) { return _mm512_div_ps(a, b); }
+				static V div_or_zero(V a, V b)
+				{
+					__mmask16 nonzero = _mm512_cmp_ps_mask(b, _mm512_setzero_ps(), _CMP_NEQ_OQ);
+					return _mm512_maskz_div_ps(nonzero, a, b);
+				}
+				static float reduce(V v)
+				{
+					float lanes[width];
+					_mm512_storeu_ps(lanes, v);
+					return scalar::sum<scalar::Lanes<float>, float>(lanes, width);
+				}
+			};
+
+			SBN_KERNEL_LOOPS
+		}
+#pragma GCC pop_options
+#endif
+
+
+		int get_supported_instruction_set()
+		{
+#ifdef SBN_X86_KERNELS
+			__builtin_cpu_init();
+			if (__builtin_cpu_supports("avx512f")) return kernels::KERNEL_AVX512;
+			if (__builtin_cpu_supports("avx2")) return kernels::KERNEL_AVX2;
+#endif
+			return kernels::KERNEL_SCALAR;
+		}
+
+
+		int supported_instruction_set()
+		{
+			static const int returnval = get_supported_instruction_set();
+			return returnval;
+		}
+
+
+		std::atomic<int>& current_instruction_set()
+		{
+			static std::atomic<int> returnval(supported_instruction_set());
+			return returnval;
+		}
+
+
+		// One table of loops per instruction set, indexed by KERNEL_*.  Without
+		// x86 support every entry is the scalar one.
+		template <class T, class Avx2, class Avx512>
+		const KernelTable<T>& get_table()
+		{
+			static const KernelTable<T> tables[] = {
+				scalar::make_table<scalar::Lanes<T>, T>(),
+#ifdef SBN_X86_KERNELS
+				avx2::make_table<Avx2, T>(),
+				avx512::make_table<Avx512, T>()
+#else
+				scalar::make_table<scalar::Lanes<T>, T>(),
+				scalar::make_table<scalar::Lanes<T>, T>()
+#endif
+			};
+			return tables[current_instruction_set().load(std::memory_order_relaxed)];
+		}
+
+
+#ifdef SBN_X86_KERNELS
+		const KernelTable<double>& table(double)
+		{
+			return get_table<double, avx2::Double, avx512::Double>();
+		}
+
+
+		const KernelTable<float>& table(float)
+		{
+			return get_table<float, avx2::Float, avx512::Float>();
+		}
+#else
+		const KernelTable<double>& table(double)
+		{
+			return get_table<double, void, void>();
+		}
+
+
+		const KernelTable<float>& table(float)
+		{
+			return get_table<float, void, void>();
+		}
+#endif
+
+	}
+
+
+	namespace kernels
+	{
+
+		int get_instruction_set()
+		{
+			return current_instruction_set().load();
+		}
+
+
+		int set_instruction_set(int instruction_set)
+		{
+			if (instruction_set < KERNEL_SCALAR) instruction_set = KERNEL_SCALAR;
+			if (instruction_set > supported_instruction_set())
+				instruction_set = supported_instruction_set();
+			current_instruction_set().store(instruction_set);
+			return instruction_set;
+		}
+
+
+		void multiply(double *out, const double *a, const double *b, size_t n)
+		{
+			table(double()).multiply(out, a, b, n);
+		}
+
+
+		void multiply(float *out, const float *a, const float *b, size_t n)
+		{
+			table(float()).multiply(out, a, b, n);
+		}
+
+
+		void multiply(double *out, const double *a, double b, size_t n)
+		{
+			table(double()).multiply_scalar(out, a, b, n);
+		}
+
+
+		void multiply(float *out, const float *a, float b, size_t n)
+		{
+			table(float()).multiply_scalar(out, a, b, n);
+		}
+
+
+		void divide(double *out, const double *a, const double *b, size_t n)
+		{
+			table(double()).divide(out, a, b, n);
+		}
+
+
+		void divide(float *out, const float *a, const float *b, size_t n)
+		{
+			table(float()).divide(out, a, b, n);
+		}
+
+
+		void divide(double *out, const double *a, double b, size_t n)
+		{
+			table(double()).divide_scalar(out, a, b, n);
+		}
+
+
+		void divide(float *out, const float *a, float b, size_t n)
+		{
+			table(float()).divide_scalar(out, a, b, n);
+		}
+
+
+		void divide(double *out, double a, const double *b, size_t n)
+		{
+			table(double()).scalar_divide(out, a, b, n);
+		}
+
+
+		void divide(float *out, float a, const float *b, size_t n)
+		{
+			table(float()).scalar_divide(out, a, b, n);
+		}
+
+
+		void add(double *target, const double *source, size_t n)
+		{
+			table(double()).add(target, source, n);
+		}
+
+
+		void add(float *target, const float *source, size_t n)
+		{
+			table(float()).add(target, source, n);
+		}
+
+
+		void maximum(double *target, const double *source, size_t n)
+		{
+			table(double()).maximum(target, source, n);
+		}
+
+
+		void maximum(float *target, const float *source, size_t n)
+		{
+			table(float()).maximum(target, source, n);
+		}
+
+
+		double sum(const double *values, size_t n)
+		{
+			return table(double()).sum(values, n);
+		}
+
+
+		float sum(const float *values, size_t n)
+		{
+			return table(float()).sum(values, n);
+		}
+
+
+		void scale(double *values, double factor, size_t n)
+		{
+			table(double()).scale(values, factor, n);
+		}
+
+
+		void scale(float *values, float factor, size_t n)
+		{
+			table(float()).scale(values, factor, n);
+		}
+
+	}
+
+}
@@ -21,33 +21,36 @@
 
 
 #include "sbn.h"
+#include <fstream>
 
 
 namespace sbn
 {
-	int Net::m_count = 0;
+	std::atomic<int> Net::m_count(0);
 
 	/** Default Constructor
 	 *
 	 * Constructs a new network.  If a title for a network is not specified, it
 	 * gets set to  Net1, Net2, etc.  depending on how many networks have already
-	 * been created. Title is used to export network to a file--a feature that is
-	 * still pending.
+	 * been created. Title is used to name the network when it is written to a
+	 * file.
 	 */
 	Net::Net(const string& title)
+		: m_compiled_revision(0),
+		  m_precision(PRECISION_DOUBLE),
+		  m_log_domain(false),
+		  m_context(shared_ptr<const CompiledNet>())
 	{
-		if (m_count == 0)
-		{
-			// seed the random number generator
-			srandom(time(0) * getpid());
-		}
-		m_count++;
-		if (title.empty()) m_title = "Net" + std::to_string(m_count);
+		int count = ++m_count;
+
+		// seed the random number generator
+		m_context.get_random().seed(time(0) * getpid() + count);
+		if (title.empty()) m_title = "Net" + std::to_string(count);
 		else m_title = title;
 	}
 
 
-	Net::Net(const Net& net)
+	Net::Net(const Net& net) : m_context(shared_ptr<const CompiledNet>())
 	{
 		*this = net;
 	}
@@ -59,7 +62,20 @@ namespace sbn
 		{
 			m_title = net.m_title;
 			m_nodes = net.m_nodes;
+			m_owned_nodes = net.m_owned_nodes;
 			m_evidence = net.m_evidence;
+			m_compiled = net.m_compiled;
+			m_compiled_revision = net.m_compiled_revision;
+			m_precision = net.m_precision;
+			m_log_domain = net.m_log_domain;
+
+			// the context leaves its calibration state behind when copied
+			m_context = net.m_context;
+
+			// but there's no need for more than one pool of threads
+			m_options = net.m_options;
+			m_cache = net.m_cache;
+			m_thread_pool = net.m_thread_pool;
 		}
 
 		return *this;
@@ -69,6 +85,7 @@ namespace sbn
 	void Net::add_node(Node *node)
 	{
 		m_nodes[node->get_name()] = node;
+		m_compiled.reset();
 	}
 
 
@@ -78,122 +95,453 @@ namespace sbn
 	}
 
 
-	// Used to compare the values inside a map, rather than the keys.
-	// We use this below to get the most frequent state
-	bool value_compare(const std::pair<string, int>& lhs,
-	                   const std::pair<string, int>& rhs)
+	void Net::add_evidence(const string& nodename, const string& state)
+	{
+		m_evidence.set_node(nodename, state);
+	}
+
+
+	void Net::retract_evidence(const string& nodename)
+	{
+		m_evidence.remove_node(nodename);
+	}
+
+
+	void Net::set_inference_mode(int mode) throw(runtime_error)
+	{
+		m_context.set_inference_mode(mode);
+	}
+
+
+	int Net::get_inference_mode() const
+	{
+		return m_context.get_inference_mode();
+	}
+
+
+	void Net::set_num_chains(int num_chains)
+	{
+		m_options.num_chains = num_chains > 1 ? num_chains : 1;
+	}
+
+
+	int Net::get_num_chains() const
+	{
+		return m_options.num_chains;
+	}
+
+
+	void Net::set_query_options(const QueryOptions& options)
+	{
+		m_options = options;
+	}
+
+
+	const QueryOptions& Net::get_query_options() const
+	{
+		return m_options;
+	}
+
+
+	void Net::set_cache_size(size_t entries)
+	{
+		m_cache.set_capacity(entries);
+	}
+
+
+	size_t Net::get_cache_size() const
+	{
+		return m_cache.get_capacity();
+	}
+
+
+	// Both settings change how the tables are compiled, so the next query
+	// recompiles the network.
+	void Net::set_precision(int precision) throw(runtime_error)
 	{
-		return lhs.second < rhs.second;
+		if (precision != PRECISION_DOUBLE && precision != PRECISION_FLOAT)
+			throw runtime_error("Invalid precision");
+		if (precision == m_precision) return;
+		m_precision = precision;
+		m_compiled.reset();
 	}
 
 
-	/** Returns the estimated posterior probability for the specified node based
-	 * on previously-supplied evidence, using the Markov Chain Monte Carlo
-	 * algorithm.  The MCMC algorithm generates each event by making a random
-	 * change to the preceding event.  The next state is generated by randomly
-	 * sampling a value for one of the nonevidence variables Xi, conditioned on
-	 * the current values of the variables in the Markov blanket of Xi.  MCMC
-	 * basically wanders randomly around the state space--the space of possible
-	 * complete assignments--flipping one variable at a time, but keeping the
-	 * evidence variables fixed.  The sampling process works because it settles
-	 * into a "dynamic equilibrium" in which the long-run fraction of time spent
-	 * in each state is exactly proportional to its posterior probability.
+	int Net::get_precision() const
+	{
+		return m_precision;
+	}
+
+
+	void Net::set_log_domain(bool log_domain)
+	{
+		if (log_domain == m_log_domain) return;
+		m_log_domain = log_domain;
+		m_compiled.reset();
+	}
+
+
+	bool Net::is_log_domain() const
+	{
+		return m_log_domain;
+	}
+
+
+	void Net::set_seed(unsigned long long seed)
+	{
+		m_context.seed(seed);
+	}
+
+
+	/** Returns the posterior probability for the specified node based on
+	 * previously-supplied evidence, computed with the algorithm selected by
+	 * set_inference_mode().
 	 */
 	StateProbabilityMap Net::query_node(string nodename)
 	{
-		map<string, int> state_frequencies;
-		map<string, bool> nodes_visited;
-		map<string, bool>::iterator nodes_visited_iter;
-		ObservationMap observations;
-		ObservationMap::iterator end, event_iter;
-		string name;
-		Event e = generate_random_event();
-		NodeMap::iterator node_iter;
+		return query_node(nodename, m_options);
+	}
+
 
-		for (int i = 0; i < MCMC_NUM_SAMPLES; ++i)
+	StateProbabilityMap Net::query_node(string nodename,
+	                                    const QueryOptions& options)
+	{
+		return query_nodes(vector<string>(1, nodename), options)[nodename];
+	}
+
+
+	NodeProbabilityMap Net::query_nodes(const vector<string>& nodenames)
+	{
+		return query_nodes(nodenames, m_options);
+	}
+
+
+	NodeProbabilityMap Net::query_nodes(const vector<string>& nodenames,
+	                                    const QueryOptions& options)
+	{
+		QueryContext& context = get_context();
+		shared_ptr<const CompiledNet> model = context.get_model();
+		vector<int> ids;
+		for (size_t i = 0; i < nodenames.size(); ++i)
 		{
-			string state = e.get_node_state(nodename);
-			state_frequencies[e.get_node_state(nodename)]++;
-			nodes_visited.clear();
+			ids.push_back(model->get_node_id(nodenames[i]));
+		}
 
-			observations = e.get_observations();
-			end = observations.end();
-			for (event_iter = observations.begin(); event_iter != end; ++event_iter)
+		vector< vector<double> > posteriors;
+		int mode = context.get_inference_mode();
+		if (!m_cache.find(m_evidence, ids, mode, options, posteriors))
+		{
+			if (options.num_chains > 1 && !m_thread_pool)
+				m_thread_pool.reset(new ThreadPool());
+			posteriors = context.query(ids, options, m_thread_pool.get());
+			m_cache.insert(m_evidence, ids, mode, options, posteriors);
+		}
+
+		NodeProbabilityMap returnval;
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			StateProbabilityMap& states = returnval[model->get_node_name(ids[i])];
+			for (size_t s = 0; s < posteriors[i].size(); ++s)
 			{
-				name = event_iter->first;
-				nodes_visited_iter = nodes_visited.find(name);
+				states[model->get_state_name(ids[i], s)] = posteriors[i][s];
+			}
+		}
+		return returnval;
+	}
 
-				// if this node is already set in the evidence or we've already
-				// generated a random state for this node, skip over it
-				if (m_evidence.has_node(name) ||
-				    nodes_visited_iter != nodes_visited.end())
-					continue;
 
-				node_iter = m_nodes.find(name);
-				if (node_iter != m_nodes.end())
-				{
-					e.set_node(name,
-						node_iter->second->get_random_state_with_markov_blanket(e));
-				}
-				nodes_visited[name] = true;
-			}
+	vector< vector< vector<double> > > Net::query_batch(const EvidenceBatch& batch,
+	                                                    const vector<string>& nodenames)
+		throw(runtime_error)
+	{
+		return query_batch(batch, nodenames, m_options);
+	}
+
+
+	vector< vector< vector<double> > > Net::query_batch(const EvidenceBatch& batch,
+	                                                    const vector<string>& nodenames,
+	                                                    const QueryOptions& options)
+		throw(runtime_error)
+	{
+		shared_ptr<const CompiledNet> model = compile();
+		batch.validate(*model);
+
+		vector<int> ids;
+		for (size_t i = 0; i < nodenames.size(); ++i)
+		{
+			ids.push_back(model->get_node_id(nodenames[i]));
 		}
 
-		// normalize results
-		StateProbabilityMap returnval;
-		map<string, int>::iterator freq_iter;
-		int magnitude = 0;
+		int rows = batch.num_rows();
+		vector< vector< vector<double> > > returnval(rows);
+		if (rows == 0) return returnval;
+		if (!m_thread_pool) m_thread_pool.reset(new ThreadPool());
 
-		for (freq_iter = state_frequencies.begin();
-		     freq_iter != state_frequencies.end();
-		     ++freq_iter)
+		// the rows already keep the workers busy, so each runs a single chain
+		int mode = get_inference_mode();
+		bool sampling = mode != INFERENCE_MODE_EXACT &&
+		                mode != INFERENCE_MODE_JUNCTION_TREE;
+		QueryOptions row_options = options;
+		row_options.num_chains = 1;
+		vector<RandomEngine> streams;
+		for (int r = 0; sampling && r < rows; ++r)
 		{
-			magnitude += freq_iter->second;
+			streams.push_back(m_context.get_random().split());
 		}
 
-		for (freq_iter = state_frequencies.begin();
-		     freq_iter != state_frequencies.end();
-		     ++freq_iter)
+		// scratch space is per worker and reused for all of its rows
+		int num_workers = m_thread_pool->num_threads();
+		vector<QueryContext> contexts(num_workers,
+		                              QueryContext(model, mode));
+		vector<Assignment> assignments(num_workers, Assignment(model->num_nodes()));
+
+		ThreadPool::Task task = [&](int row, int worker)
 		{
-			name = freq_iter->first;
-			returnval[name] = freq_iter->second / (double)magnitude;
+			Assignment& evidence = assignments[worker];
+			std::fill(evidence.begin(), evidence.end(), STATE_UNSET);
+			batch.get_row(row, evidence);
+
+			QueryContext& context = contexts[worker];
+			context.set_evidence(evidence);
+			if (sampling) context.set_random(streams[row]);
+			returnval[row] = context.query(ids, row_options);
+		};
+		m_thread_pool->run(rows, task);
+
+		return returnval;
+	}
+
+
+	Event Net::query_mpe()
+	{
+		QueryContext& context = get_context();
+		return context.get_model()->to_event(context.query_mpe());
+	}
+
+
+	Event Net::query_map(const vector<string>& nodenames)
+	{
+		QueryContext& context = get_context();
+		shared_ptr<const CompiledNet> model = context.get_model();
+		vector<int> ids;
+		for (size_t i = 0; i < nodenames.size(); ++i)
+		{
+			ids.push_back(model->get_node_id(nodenames[i]));
 		}
+		return model->to_event(context.query_map(ids));
+	}
 
+
+	NodeProbabilityMap Net::query_all_nodes()
+	{
+		return query_all_nodes(m_options);
+	}
+
+
+	NodeProbabilityMap Net::query_all_nodes(const QueryOptions& options)
+	{
+		vector<string> nodenames;
+		for (NodeMap::iterator i = m_nodes.begin(); i != m_nodes.end(); ++i)
+		{
+			nodenames.push_back(i->first);
+		}
+		return query_nodes(nodenames, options);
+	}
+
+
+	QueryContext Net::new_context() throw(runtime_error)
+	{
+		QueryContext returnval = get_context();
+		returnval.set_random(m_context.get_random().split());
 		return returnval;
 	}
 
 
-	/**
-	 * Returns an event in which nodes that are not fixed by the evidence are set
-	 * to random states whose frequencies (after repeated calls) are consistent
-	 * with the network's joint probability distribution.
-	 */
-	Event Net::generate_random_event()
+	// Brings the network's own context up to date with the nodes and the
+	// evidence.  A recompiled network gets a fresh tree and an empty cache, but
+	// the generator carries on.
+	QueryContext& Net::get_context() throw(runtime_error)
+	{
+		shared_ptr<const CompiledNet> model = compile();
+		if (m_context.get_model() != model)
+		{
+			m_context.set_model(model);
+			m_cache.clear();
+		}
+		m_context.set_evidence(m_evidence);
+		return m_context;
+	}
+
+
+	shared_ptr<const CompiledNet> Net::compile() throw(runtime_error)
+	{
+		unsigned long revision = get_revision();
+		if (!m_compiled || revision != m_compiled_revision)
+		{
+			m_compiled.reset(new CompiledNet(m_nodes, m_precision, m_log_domain));
+			m_compiled_revision = revision;
+		}
+		return m_compiled;
+	}
+
+
+	void Net::save(const string& filename) throw(runtime_error)
+	{
+		compile()->save(filename);
+	}
+
+
+	void Net::learn_parameters(const string& filename, double prior)
+		throw(runtime_error)
+	{
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in) throw runtime_error("Unable to open " + filename);
+		learn_parameters(in, prior);
+	}
+
+
+	// The tables are estimated against the compiled model, whose tables are
+	// laid out like the nodes' own, so they can be handed straight back.
+	void Net::learn_parameters(std::istream& in, double prior) throw(runtime_error)
 	{
-		Event returnval = m_evidence;
-		bool incomplete_evidence;
-		string name;
+		if (prior < 0) throw runtime_error("Prior must not be negative");
 
-		do
+		shared_ptr<const CompiledNet> model = compile();
+		DataReader reader(in, model);
+		ParameterLearner learner(model);
+		if (!m_thread_pool) m_thread_pool.reset(new ThreadPool());
+		learner.add(reader, *m_thread_pool);
+
+		for (NodeMap::iterator iter = m_nodes.begin(); iter != m_nodes.end(); ++iter)
 		{
-			incomplete_evidence = false;
-			for (NodeMap::iterator iter = m_nodes.begin();
-		     	 iter != m_nodes.end();
-		     	 ++iter)
+			int id = model->get_node_id(iter->first);
+			iter->second->set_probabilities(learner.get_table(id, prior));
+		}
+	}
+
+
+	int Net::learn_parameters_em(const string& filename, double prior,
+	                             int max_iterations, double tolerance)
+		throw(runtime_error)
+	{
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in) throw runtime_error("Unable to open " + filename);
+		return learn_parameters_em(in, prior, max_iterations, tolerance);
+	}
+
+
+	// Each iteration compiles the current tables once and runs every row
+	// against that model, so rows never turn into Events.  The workers' counts
+	// are merged into one learner before the tables are replaced.
+	int Net::learn_parameters_em(std::istream& in, double prior,
+	                             int max_iterations, double tolerance)
+		throw(runtime_error)
+	{
+		if (prior < 0) throw runtime_error("Prior must not be negative");
+		if (!m_thread_pool) m_thread_pool.reset(new ThreadPool());
+
+		std::streampos start = in.tellg();
+		int iteration = 0;
+		double change = tolerance + 1;
+		while (iteration < max_iterations && change > tolerance)
+		{
+			if (iteration > 0)
 			{
-				name = iter->second->get_name();
-				// skip this node if it is already set in the evidence
-				if (m_evidence.has_node(name)) continue;
+				in.clear();
+				in.seekg(start);
+				if (!in) throw runtime_error("Unable to rewind data file");
+			}
+
+			shared_ptr<const CompiledNet> model = compile();
+			DataReader reader(in, model);
+			ParameterLearner learner(model);
+			learner.add_expected(reader, *m_thread_pool);
 
-				if (iter->second->can_be_evaluated(returnval))
+			change = 0;
+			for (NodeMap::iterator iter = m_nodes.begin(); iter != m_nodes.end(); ++iter)
+			{
+				const vector<double>& old_table = iter->second->get_probabilities();
+				vector<double> table = learner.get_table(model->get_node_id(iter->first),
+				                                         prior);
+				for (size_t i = 0; i < table.size(); ++i)
 				{
-					returnval.set_node(name, iter->second->get_random_state(returnval));
-					continue;
+					change = std::max(change, std::fabs(table[i] - old_table[i]));
 				}
-				incomplete_evidence = true;
+				iter->second->set_probabilities(table);
 			}
-		} while (incomplete_evidence);
+			iteration++;
+		}
+		return iteration;
+	}
+
 
+	void Net::learn_structure(const string& filename, double prior,
+	                          const StructureOptions& options) throw(runtime_error)
+	{
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in) throw runtime_error("Unable to open " + filename);
+		learn_structure(in, prior, options);
+	}
+
+
+	// Node ids only depend on the names, so the data read against the old
+	// model still fits the one compiled after relinking.
+	void Net::learn_structure(std::istream& in, double prior,
+	                          const StructureOptions& options) throw(runtime_error)
+	{
+		if (prior < 0) throw runtime_error("Prior must not be negative");
+
+		shared_ptr<const CompiledNet> model = compile();
+		DataReader reader(in, model);
+		EvidenceBatch data;
+		reader.read(data);
+		StructureLearner learner(model, data, options);
+		if (!m_thread_pool) m_thread_pool.reset(new ThreadPool());
+		vector< vector<int> > parents = learner.search(*m_thread_pool);
+
+		vector<Node*> nodes(model->num_nodes());
+		for (NodeMap::iterator iter = m_nodes.begin(); iter != m_nodes.end(); ++iter)
+		{
+			nodes[model->get_node_id(iter->first)] = iter->second;
+		}
+		for (int id = 0; id < model->num_nodes(); ++id)
+		{
+			const vector<int>& old_parents = model->get_parents(id);
+			for (size_t p = 0; p < old_parents.size(); ++p)
+			{
+				if (!binary_search(parents[id].begin(), parents[id].end(), old_parents[p]))
+					nodes[id]->remove_parent(nodes[old_parents[p]]);
+			}
+			for (size_t p = 0; p < parents[id].size(); ++p)
+			{
+				if (find(old_parents.begin(), old_parents.end(), parents[id][p]) ==
+				    old_parents.end())
+					nodes[id]->add_parent(nodes[parents[id][p]]);
+			}
+		}
+
+		model = compile();
+		ParameterLearner fit(model);
+		fit.add(data);
+		for (int id = 0; id < model->num_nodes(); ++id)
+		{
+			nodes[id]->set_probabilities(fit.get_table(id, prior));
+		}
+	}
+
+
+	// Every change to a node raises its revision, including being assigned
+	// from another node, so their sum changes whenever any node in the network
+	// has been modified.
+	unsigned long Net::get_revision() const
+	{
+		unsigned long returnval = 0;
+		for (NodeMap::const_iterator iter = m_nodes.begin();
+		     iter != m_nodes.end();
+		     ++iter)
+		{
+			returnval += iter->second->m_revision;
+		}
 		return returnval;
 	}
 }
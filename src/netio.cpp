@@ -0,0 +1,1101 @@
+/*
+ * netio.cpp - Reading and writing sbn::Net in standard file formats
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+#include <fstream>
+#include <cstring>
+#include <cctype>
+
+
+namespace sbn
+{
+
+	namespace
+	{
+
+		const char *FORMAT_NAMES[] = { "BIF", "XMLBIF", "Hugin" };
+
+
+		// picks the format from the file name's extension
+		int get_format(const string& filename) throw(runtime_error)
+		{
+			string extension = filename.substr(filename.find_last_of('.') + 1);
+			transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+			if (extension == "bif") return FORMAT_BIF;
+			if (extension == "xml" || extension == "xmlbif") return FORMAT_XMLBIF;
+			if (extension == "net") return FORMAT_HUGIN;
+			throw runtime_error("Unknown file format: " + filename);
+		}
+
+
+		/** Splits BIF and Hugin files into tokens.
+		 *
+		 * A token is a punctuation character, a quoted string (returned without
+		 * its quotes) or a run of other non-blank characters.  Comments are
+		 * skipped: // and C-style ones in BIF, and % to the end of the line in
+		 * Hugin files.  The input is read one character at a time, so files of
+		 * any size can be read without holding them in memory.
+		 */
+		class Tokenizer
+		{
+		public:
+			Tokenizer(std::istream& in, int format)
+				: m_buffer(in.rdbuf()), m_format(format), m_line(1), m_quoted(false)
+			{
+			}
+
+			/// Returns the next token, or an empty string at the end of the input
+			const string& next() throw(runtime_error)
+			{
+				m_token.clear();
+				m_quoted = false;
+				int c = skip_blanks();
+				if (c == EOF) return m_token;
+
+				m_buffer->sbumpc();
+				if (c == '"')
+				{
+					m_quoted = true;
+					while ((c = m_buffer->sbumpc()) != '"')
+					{
+						if (c == EOF) error("unterminated string");
+						if (c == '\n') m_line++;
+						m_token += (char)c;
+					}
+				}
+				else
+				{
+					m_token += (char)c;
+					if (!is_punctuation(c))
+					{
+						while ((c = m_buffer->sgetc()) != EOF && !isspace(c) &&
+						       !is_punctuation(c) && c != '"')
+						{
+							m_token += (char)m_buffer->sbumpc();
+						}
+					}
+				}
+				return m_token;
+			}
+
+			/// Returns the last token
+			const string& value() const
+			{
+				return m_token;
+			}
+
+			/// Tells whether the last token was a quoted string
+			bool quoted() const
+			{
+				return m_quoted;
+			}
+
+			/// Tells whether the last token was the given punctuation
+			bool is(char punctuation) const
+			{
+				return !m_quoted && m_token.size() == 1 && m_token[0] == punctuation;
+			}
+
+			/// Reads a token and fails unless it is the given punctuation
+			void expect(char punctuation) throw(runtime_error)
+			{
+				next();
+				if (!is(punctuation)) error(string("expected '") + punctuation + "'");
+			}
+
+			/// Reads a name: a quoted string or a word that isn't punctuation
+			const string& next_name() throw(runtime_error)
+			{
+				next();
+				if (m_token.empty() || (!m_quoted && is_punctuation(m_token[0])))
+					error("expected a name");
+				return m_token;
+			}
+
+			/// Converts the last token to a number
+			double number() throw(runtime_error)
+			{
+				char *end;
+				double returnval = strtod(m_token.c_str(), &end);
+				if (m_quoted || m_token.empty() || *end != '\0') error("expected a number");
+				return returnval;
+			}
+
+			/// Skips tokens up to and including the given punctuation
+			void skip_past(char punctuation) throw(runtime_error)
+			{
+				while (!is(punctuation))
+				{
+					if (next().empty()) error(string("expected '") + punctuation + "'");
+				}
+			}
+
+			/// Skips a block in braces, the opening brace having just been read
+			void skip_block() throw(runtime_error)
+			{
+				int depth = 1;
+				while (depth > 0)
+				{
+					if (next().empty()) error("expected '}'");
+					if (is('{')) depth++;
+					else if (is('}')) depth--;
+				}
+			}
+
+			void error(const string& message) const throw(runtime_error)
+			{
+				throw runtime_error(string(FORMAT_NAMES[m_format]) + " file, line " +
+				                    std::to_string(m_line) + ": " + message);
+			}
+
+		private:
+			static bool is_punctuation(int c)
+			{
+				return c != EOF && strchr("{}()[]|,;=", c) != 0;
+			}
+
+			// returns the first character after blanks and comments, unread
+			int skip_blanks()
+			{
+				for (;;)
+				{
+					int c = m_buffer->sgetc();
+					if (c == '\n') m_line++;
+					if (c != EOF && isspace(c))
+					{
+						m_buffer->sbumpc();
+					}
+					else if (c == '%' && m_format == FORMAT_HUGIN)
+					{
+						while ((c = m_buffer->sgetc()) != EOF && c != '\n') m_buffer->sbumpc();
+					}
+					else if (c == '/' && m_format == FORMAT_BIF)
+					{
+						m_buffer->sbumpc();
+						int d = m_buffer->sgetc();
+						if (d == '/')
+						{
+							while ((c = m_buffer->sgetc()) != EOF && c != '\n') m_buffer->sbumpc();
+						}
+						else if (d == '*')
+						{
+							m_buffer->sbumpc();
+							int last = 0;
+							while ((c = m_buffer->sbumpc()) != EOF && !(last == '*' && c == '/'))
+							{
+								if (c == '\n') m_line++;
+								last = c;
+							}
+						}
+						else
+						{
+							m_buffer->sungetc();
+							return '/';
+						}
+					}
+					else return c;
+				}
+			}
+
+			std::streambuf *m_buffer;
+			int m_format;
+			int m_line;
+			string m_token;
+			bool m_quoted;
+		};
+
+
+		/** Pulls elements and text out of an XML document.
+		 *
+		 * Only as much of XML is understood as XMLBIF files use: elements
+		 * (whose attributes are skipped), text with the predefined entities,
+		 * CDATA sections, comments, processing instructions and a DOCTYPE with
+		 * an internal subset.  Element names are returned in upper case.
+		 */
+		class XmlReader
+		{
+		public:
+			enum { END_OF_INPUT, START, END, TEXT };
+
+			XmlReader(std::istream& in) : m_buffer(in.rdbuf()), m_line(1)
+			{
+			}
+
+			/// Reads the next start tag, end tag or run of text
+			int next() throw(runtime_error)
+			{
+				m_value.clear();
+				int c = m_buffer->sgetc();
+				if (c == EOF) return END_OF_INPUT;
+				if (c != '<')
+				{
+					while ((c = m_buffer->sgetc()) != EOF && c != '<')
+					{
+						m_buffer->sbumpc();
+						if (c == '\n') m_line++;
+						if (c == '&') m_value += get_entity();
+						else m_value += (char)c;
+					}
+					return TEXT;
+				}
+
+				m_buffer->sbumpc();
+				c = m_buffer->sgetc();
+				if (c == '?')
+				{
+					skip_past("?>");
+					return next();
+				}
+				if (c == '!')
+				{
+					m_buffer->sbumpc();
+					string start;
+					while (start.size() < 7 && (c = m_buffer->sgetc()) != EOF &&
+					       !isspace(c) && c != '>')
+					{
+						start += (char)m_buffer->sbumpc();
+						if (start == "--" || start == "[CDATA[") break;
+					}
+					if (start == "--") skip_past("-->");
+					else if (start == "[CDATA[")
+					{
+						read_past("]]>");
+						return TEXT;
+					}
+					else skip_declaration();
+					return next();
+				}
+
+				bool end = c == '/';
+				if (end) m_buffer->sbumpc();
+				while ((c = m_buffer->sgetc()) != EOF && !isspace(c) && c != '>' && c != '/')
+				{
+					m_value += (char)toupper(m_buffer->sbumpc());
+				}
+
+				// skip the attributes, noting an empty element
+				bool empty = false;
+				while ((c = m_buffer->sbumpc()) != '>')
+				{
+					if (c == EOF) error("unterminated tag");
+					if (c == '\n') m_line++;
+					if (c == '"' || c == '\'')
+					{
+						int quote = c;
+						while ((c = m_buffer->sbumpc()) != quote)
+						{
+							if (c == EOF) error("unterminated attribute");
+						}
+					}
+					empty = c == '/';
+				}
+				if (empty)
+				{
+					m_pending_end = m_value;
+					return START;
+				}
+				return end ? END : START;
+			}
+
+			/// Returns the name of the element or the text just read
+			const string& value() const
+			{
+				return m_value;
+			}
+
+			/// Returns the name of an element that was empty (<NAME/>), whose end
+			/// has to be reported right after its start, and forgets it
+			string take_pending_end()
+			{
+				string returnval;
+				returnval.swap(m_pending_end);
+				return returnval;
+			}
+
+			void error(const string& message) const throw(runtime_error)
+			{
+				throw runtime_error("XMLBIF file, line " + std::to_string(m_line) +
+				                    ": " + message);
+			}
+
+		private:
+			char get_entity() throw(runtime_error)
+			{
+				string name;
+				int c;
+				while ((c = m_buffer->sbumpc()) != ';')
+				{
+					if (c == EOF || name.size() > 8) error("invalid entity");
+					name += (char)c;
+				}
+				if (name == "lt") return '<';
+				if (name == "gt") return '>';
+				if (name == "amp") return '&';
+				if (name == "quot") return '"';
+				if (name == "apos") return '\'';
+				if (name.size() > 1 && name[0] == '#')
+				{
+					long code = name[1] == 'x' ? strtol(name.c_str() + 2, 0, 16) :
+					                             strtol(name.c_str() + 1, 0, 10);
+					if (code > 0 && code < 128) return (char)code;
+				}
+				error("unsupported entity &" + name + ";");
+				return 0;
+			}
+
+			void skip_past(const char *terminator) throw(runtime_error)
+			{
+				read_past(terminator);
+				m_value.clear();
+			}
+
+			// reads text up to the terminator into m_value, dropping the terminator
+			void read_past(const char *terminator) throw(runtime_error)
+			{
+				size_t length = strlen(terminator);
+				int c;
+				while ((c = m_buffer->sbumpc()) != EOF)
+				{
+					if (c == '\n') m_line++;
+					m_value += (char)c;
+					if (m_value.size() >= length &&
+					    m_value.compare(m_value.size() - length, length, terminator) == 0)
+					{
+						m_value.erase(m_value.size() - length);
+						return;
+					}
+				}
+				error(string("expected ") + terminator);
+			}
+
+			// skips <!DOCTYPE ...> and the like, with an internal subset in brackets
+			void skip_declaration() throw(runtime_error)
+			{
+				int depth = 0;
+				int c;
+				while ((c = m_buffer->sbumpc()) != EOF)
+				{
+					if (c == '\n') m_line++;
+					if (c == '[') depth++;
+					else if (c == ']') depth--;
+					else if (c == '>' && depth <= 0) return;
+				}
+				error("unterminated declaration");
+			}
+
+			std::streambuf *m_buffer;
+			int m_line;
+			string m_value;
+			string m_pending_end;
+		};
+
+
+		/** The nodes read from a file, before they are handed to the network.
+		 *
+		 * Tables are built directly in the layout Node::set_probabilities()
+		 * takes, once a node's parents are known.
+		 */
+		class ParsedNet
+		{
+		public:
+			string title;
+			vector< shared_ptr<Node> > nodes;
+
+			/// Creates a node with the given states
+			void add_node(const string& name, const vector<string>& states)
+				throw(runtime_error)
+			{
+				if (m_names.find(name) >= 0) throw runtime_error("Node " + name + " is defined twice");
+				if (states.empty()) throw runtime_error("Node " + name + " has no states");
+				m_names.intern(name);
+				nodes.push_back(shared_ptr<Node>(new Node(name)));
+				m_states.push_back(SymbolTable());
+				for (size_t s = 0; s < states.size(); ++s)
+				{
+					nodes.back()->add_state(states[s]);
+					m_states.back().intern(states[s]);
+				}
+				if (m_states.back().size() != (int)states.size())
+					throw runtime_error("Node " + name + " has the same state twice");
+				m_parents.push_back(vector<int>());
+				m_has_table.push_back(false);
+			}
+
+			/// Returns the index of a node that was read earlier
+			int find_node(const string& name) const throw(runtime_error)
+			{
+				int returnval = m_names.find(name);
+				if (returnval < 0) throw runtime_error("Node " + name + " is not defined");
+				return returnval;
+			}
+
+			int get_num_states(int node) const
+			{
+				return m_states[node].size();
+			}
+
+			/// Returns the index of a state of a node
+			int find_state(int node, const string& state) const throw(runtime_error)
+			{
+				int returnval = m_states[node].find(state);
+				if (returnval < 0)
+					throw runtime_error("Node " + nodes[node]->get_name() +
+					                    " has no state " + state);
+				return returnval;
+			}
+
+			/// Links the parents to a node, in order, and returns the number of
+			/// rows of its table: one for each combination of parent states
+			size_t set_parents(int node, const vector<int>& parents) throw(runtime_error)
+			{
+				if (m_has_table[node])
+					throw runtime_error("Node " + nodes[node]->get_name() +
+					                    " has more than one table");
+				m_has_table[node] = true;
+				size_t rows = 1;
+				for (size_t p = 0; p < parents.size(); ++p)
+				{
+					if (find(parents.begin(), parents.begin() + p, parents[p]) !=
+					    parents.begin() + p || parents[p] == node)
+						throw runtime_error("Node " + nodes[node]->get_name() +
+						                    " has an invalid parent list");
+					nodes[node]->add_parent(nodes[parents[p]].get());
+					rows *= get_num_states(parents[p]);
+				}
+				m_parents[node] = parents;
+				return rows;
+			}
+
+			/// Throws unless every node has been given a table
+			void check_tables() const throw(runtime_error)
+			{
+				for (size_t node = 0; node < nodes.size(); ++node)
+				{
+					if (!m_has_table[node])
+						throw runtime_error("Node " + nodes[node]->get_name() +
+						                    " has no table");
+				}
+			}
+
+			/// Returns the row of a node's table for the given parent states
+			size_t get_row(int node, const vector<string>& states) const
+				throw(runtime_error)
+			{
+				const vector<int>& parents = m_parents[node];
+				if (states.size() != parents.size())
+					throw runtime_error("Wrong number of parent states for node " +
+					                    nodes[node]->get_name());
+				size_t returnval = 0;
+				for (size_t p = 0; p < parents.size(); ++p)
+				{
+					returnval = returnval * get_num_states(parents[p]) +
+						find_state(parents[p], states[p]);
+				}
+				return returnval;
+			}
+
+			/// Sets a node's table from values that list the node's states for
+			/// each row in turn, as XMLBIF and Hugin files do
+			void set_rows(int node, size_t rows, const vector<double>& values)
+				throw(runtime_error)
+			{
+				size_t num_states = get_num_states(node);
+				if (values.size() != rows * num_states)
+					throw runtime_error("Wrong number of probabilities for node " +
+					                    nodes[node]->get_name());
+				vector<double> table(values.size());
+				for (size_t r = 0; r < rows; ++r)
+				{
+					for (size_t s = 0; s < num_states; ++s)
+					{
+						table[s * rows + r] = values[r * num_states + s];
+					}
+				}
+				nodes[node]->set_probabilities(table);
+			}
+
+		private:
+			SymbolTable m_names;
+			vector<SymbolTable> m_states;
+			vector< vector<int> > m_parents;
+			vector<bool> m_has_table;
+		};
+
+
+		// Collects numbers up to a semicolon; commas between them are optional
+		void read_numbers(Tokenizer& tokens, vector<double>& values) throw(runtime_error)
+		{
+			values.clear();
+			for (;;)
+			{
+				if (tokens.next().empty()) tokens.error("expected ';'");
+				if (tokens.is(';')) return;
+				if (!tokens.is(',')) values.push_back(tokens.number());
+			}
+		}
+
+
+		void read_bif(std::istream& in, ParsedNet& net) throw(runtime_error)
+		{
+			Tokenizer tokens(in, FORMAT_BIF);
+			vector<double> values;
+			for (;;)
+			{
+				string keyword = tokens.next();
+				if (keyword.empty()) break;
+
+				if (keyword == "network")
+				{
+					net.title = tokens.next_name();
+					tokens.expect('{');
+					tokens.skip_block();
+				}
+				else if (keyword == "variable")
+				{
+					string name = tokens.next_name();
+					vector<string> states;
+					tokens.expect('{');
+					while (!tokens.next().empty() && !tokens.is('}'))
+					{
+						if (tokens.value() != "type")
+						{
+							tokens.skip_past(';');
+							continue;
+						}
+						if (tokens.next_name() != "discrete")
+							tokens.error("only discrete variables are supported");
+						tokens.expect('[');
+						tokens.next();
+						double count = tokens.number();
+						tokens.expect(']');
+						tokens.expect('{');
+						while (!tokens.next().empty() && !tokens.is('}'))
+						{
+							if (!tokens.is(',')) states.push_back(tokens.value());
+						}
+						if (count != states.size()) tokens.error("wrong number of states");
+						tokens.expect(';');
+					}
+					if (!tokens.is('}')) tokens.error("expected '}'");
+					net.add_node(name, states);
+				}
+				else if (keyword == "probability")
+				{
+					tokens.expect('(');
+					int node = net.find_node(tokens.next_name());
+					vector<int> parents;
+					tokens.next();
+					if (tokens.is('|'))
+					{
+						while (!tokens.next().empty() && !tokens.is(')'))
+						{
+							if (!tokens.is(',')) parents.push_back(net.find_node(tokens.value()));
+						}
+					}
+					if (!tokens.is(')')) tokens.error("expected ')'");
+					size_t rows = net.set_parents(node, parents);
+					size_t num_states = net.get_num_states(node);
+
+					// entries are in the node's layout, with rows filled one at a time
+					vector<double> table(rows * num_states, 0.0);
+					vector<bool> filled(rows, false);
+					tokens.expect('{');
+					while (!tokens.next().empty() && !tokens.is('}'))
+					{
+						if (tokens.is('('))
+						{
+							vector<string> states;
+							while (!tokens.next().empty() && !tokens.is(')'))
+							{
+								if (!tokens.is(',')) states.push_back(tokens.value());
+							}
+							size_t row = net.get_row(node, states);
+							read_numbers(tokens, values);
+							if (values.size() != num_states)
+								tokens.error("wrong number of probabilities");
+							for (size_t s = 0; s < num_states; ++s)
+							{
+								table[s * rows + row] = values[s];
+							}
+							filled[row] = true;
+						}
+						else if (tokens.value() == "table")
+						{
+							read_numbers(tokens, values);
+							if (values.size() != table.size())
+								tokens.error("wrong number of probabilities");
+							table = values;
+							filled.assign(rows, true);
+						}
+						else if (tokens.value() == "default")
+						{
+							read_numbers(tokens, values);
+							if (values.size() != num_states)
+								tokens.error("wrong number of probabilities");
+							for (size_t row = 0; row < rows; ++row)
+							{
+								for (size_t s = 0; !filled[row] && s < num_states; ++s)
+								{
+									table[s * rows + row] = values[s];
+								}
+							}
+							filled.assign(rows, true);
+						}
+						else tokens.skip_past(';');
+					}
+					if (!tokens.is('}')) tokens.error("expected '}'");
+					if (find(filled.begin(), filled.end(), false) != filled.end())
+						tokens.error("some rows of the table are missing");
+					net.nodes[node]->set_probabilities(table);
+				}
+				else tokens.error("unexpected " + keyword);
+			}
+		}
+
+
+		void read_hugin(std::istream& in, ParsedNet& net) throw(runtime_error)
+		{
+			Tokenizer tokens(in, FORMAT_HUGIN);
+			vector<double> values;
+			for (;;)
+			{
+				string keyword = tokens.next();
+				if (keyword.empty()) break;
+
+				if (keyword == "net")
+				{
+					tokens.expect('{');
+					tokens.skip_block();
+				}
+				else if (keyword == "node" || keyword == "discrete")
+				{
+					if (keyword == "discrete" && tokens.next_name() != "node")
+						tokens.error("only chance nodes are supported");
+					string name = tokens.next_name();
+					vector<string> states;
+					tokens.expect('{');
+					while (!tokens.next().empty() && !tokens.is('}'))
+					{
+						if (tokens.value() != "states")
+						{
+							tokens.skip_past(';');
+							continue;
+						}
+						tokens.expect('=');
+						tokens.expect('(');
+						while (!tokens.next().empty() && !tokens.is(')'))
+						{
+							states.push_back(tokens.value());
+						}
+						tokens.expect(';');
+					}
+					if (!tokens.is('}')) tokens.error("expected '}'");
+					net.add_node(name, states);
+				}
+				else if (keyword == "potential")
+				{
+					tokens.expect('(');
+					int node = net.find_node(tokens.next_name());
+					vector<int> parents;
+					tokens.next();
+					if (tokens.is('|'))
+					{
+						while (!tokens.next().empty() && !tokens.is(')'))
+						{
+							parents.push_back(net.find_node(tokens.value()));
+						}
+					}
+					if (!tokens.is(')')) tokens.error("expected ')'");
+					size_t rows = net.set_parents(node, parents);
+
+					// the nesting of the data only mirrors the parents, so it is flattened
+					bool found = false;
+					tokens.expect('{');
+					while (!tokens.next().empty() && !tokens.is('}'))
+					{
+						if (tokens.value() != "data")
+						{
+							tokens.skip_past(';');
+							continue;
+						}
+						tokens.expect('=');
+						values.clear();
+						while (!tokens.next().empty() && !tokens.is(';'))
+						{
+							if (!tokens.is('(') && !tokens.is(')')) values.push_back(tokens.number());
+						}
+						found = true;
+					}
+					if (!tokens.is('}')) tokens.error("expected '}'");
+					if (!found) tokens.error("potential without data");
+					net.set_rows(node, rows, values);
+				}
+				else if (keyword == "continuous" || keyword == "decision" ||
+				         keyword == "utility")
+					tokens.error("only chance nodes are supported");
+				else tokens.error("unexpected " + keyword);
+			}
+		}
+
+
+		void read_xmlbif(std::istream& in, ParsedNet& net) throw(runtime_error)
+		{
+			XmlReader xml(in);
+			vector<string> path;
+			string text, name;
+			vector<string> states, parents;
+			vector<double> values;
+
+			for (;;)
+			{
+				int event = xml.next();
+				if (event == XmlReader::END_OF_INPUT) break;
+				if (event == XmlReader::TEXT)
+				{
+					text += xml.value();
+					continue;
+				}
+				if (event == XmlReader::START)
+				{
+					path.push_back(xml.value());
+					text.clear();
+					string pending = xml.take_pending_end();
+					if (pending.empty()) continue;
+				}
+				else if (path.empty() || path.back() != xml.value())
+					xml.error("mismatched </" + xml.value() + ">");
+
+				// an element has ended: what it means depends on where it is
+				string element = path.back();
+				path.pop_back();
+				string parent = path.empty() ? "" : path.back();
+				if (parent == "VARIABLE" && element == "NAME") name = text;
+				else if (parent == "VARIABLE" && element == "OUTCOME") states.push_back(text);
+				else if (parent == "NETWORK" && element == "NAME") net.title = text;
+				else if (element == "VARIABLE")
+				{
+					net.add_node(name, states);
+					states.clear();
+				}
+				else if (parent == "DEFINITION" || parent == "PROBABILITY")
+				{
+					if (element == "FOR") name = text;
+					else if (element == "GIVEN") parents.push_back(text);
+					else if (element == "TABLE")
+					{
+						const char *start = text.c_str();
+						char *end;
+						values.clear();
+						for (;;)
+						{
+							double value = strtod(start, &end);
+							if (end == start) break;
+							values.push_back(value);
+							start = end;
+						}
+						while (isspace(*start)) start++;
+						if (*start != '\0') xml.error("invalid number in table");
+					}
+				}
+				else if (element == "DEFINITION" || element == "PROBABILITY")
+				{
+					int node = net.find_node(name);
+					vector<int> ids;
+					for (size_t p = 0; p < parents.size(); ++p)
+					{
+						ids.push_back(net.find_node(parents[p]));
+					}
+					net.set_rows(node, net.set_parents(node, ids), values);
+					parents.clear();
+					values.clear();
+				}
+				text.clear();
+			}
+			if (!path.empty()) xml.error("unexpected end of file");
+		}
+
+
+		// Formats a number so that it reads back exactly, with 15 digits when
+		// they are enough so that 0.1 doesn't come out as 0.10000000000000001
+		string format_number(double value)
+		{
+			char buffer[32];
+			snprintf(buffer, sizeof(buffer), "%.15g", value);
+			if (strtod(buffer, 0) != value) snprintf(buffer, sizeof(buffer), "%.17g", value);
+			return buffer;
+		}
+
+
+		// Each row of the node's table, i.e. each combination of parent states,
+		// is passed to visit in order, the last parent changing fastest.
+		template <class Visitor>
+		void visit_rows(const CompiledNet& model, int id, Visitor visit)
+		{
+			const vector<int>& parents = model.get_parents(id);
+			vector<double> values = model.get_factor(id).get_values();
+			size_t num_states = model.get_num_states(id);
+			size_t rows = values.size() / num_states;
+			vector<int> states(parents.size(), 0);
+			vector<double> row(num_states);
+			for (size_t r = 0; r < rows; ++r)
+			{
+				for (size_t s = 0; s < num_states; ++s) row[s] = values[s * rows + r];
+				visit(states, row);
+				for (int p = parents.size() - 1; p >= 0; --p)
+				{
+					if (++states[p] < model.get_num_states(parents[p])) break;
+					states[p] = 0;
+				}
+			}
+		}
+
+
+		/** Quotes a title, node or state name for the BIF and Hugin writers, so
+		 * names with blanks or punctuation read back as a single token.  Quoted
+		 * strings have no escapes, so a name can't contain a double quote.
+		 */
+		string quote(const string& name)
+		{
+			if (name.find('"') != string::npos)
+				throw runtime_error("Unable to write a name containing '\"': " + name);
+			return '"' + name + '"';
+		}
+
+
+		void write_bif(std::ostream& out, const CompiledNet& model, const string& title)
+		{
+			out << "network " << quote(title) << " {\n}\n";
+
+			int id;
+			for (id = 0; id < model.num_nodes(); ++id)
+			{
+				out << "variable " << quote(model.get_node_name(id)) << " {\n";
+				out << "  type discrete [ " << model.get_num_states(id) << " ] { ";
+				for (int s = 0; s < model.get_num_states(id); ++s)
+				{
+					out << (s > 0 ? ", " : "") << quote(model.get_state_name(id, s));
+				}
+				out << " };\n}\n";
+			}
+
+			for (id = 0; id < model.num_nodes(); ++id)
+			{
+				const vector<int>& parents = model.get_parents(id);
+				out << "probability ( " << quote(model.get_node_name(id));
+				for (size_t p = 0; p < parents.size(); ++p)
+				{
+					out << (p == 0 ? " | " : ", ") << quote(model.get_node_name(parents[p]));
+				}
+				out << " ) {\n";
+				visit_rows(model, id, [&](const vector<int>& states, const vector<double>& row)
+				{
+					out << "  ";
+					if (parents.empty()) out << "table ";
+					else
+					{
+						out << "(";
+						for (size_t p = 0; p < parents.size(); ++p)
+						{
+							out << (p > 0 ? ", " : "") << quote(model.get_state_name(parents[p], states[p]));
+						}
+						out << ") ";
+					}
+					for (size_t s = 0; s < row.size(); ++s)
+					{
+						out << (s > 0 ? ", " : "") << format_number(row[s]);
+					}
+					out << ";\n";
+				});
+				out << "}\n";
+			}
+		}
+
+
+		string escape_xml(const string& text)
+		{
+			string returnval;
+			for (size_t i = 0; i < text.size(); ++i)
+			{
+				switch (text[i])
+				{
+				case '<': returnval += "&lt;"; break;
+				case '>': returnval += "&gt;"; break;
+				case '&': returnval += "&amp;"; break;
+				case '"': returnval += "&quot;"; break;
+				default: returnval += text[i];
+				}
+			}
+			return returnval;
+		}
+
+
+		void write_xmlbif(std::ostream& out, const CompiledNet& model, const string& title)
+		{
+			out << "<?xml version=\"1.0\"?>\n<BIF VERSION=\"0.3\">\n<NETWORK>\n";
+			out << "<NAME>" << escape_xml(title) << "</NAME>\n";
+
+			int id;
+			for (id = 0; id < model.num_nodes(); ++id)
+			{
+				out << "<VARIABLE TYPE=\"nature\">\n";
+				out << "\t<NAME>" << escape_xml(model.get_node_name(id)) << "</NAME>\n";
+				for (int s = 0; s < model.get_num_states(id); ++s)
+				{
+					out << "\t<OUTCOME>" << escape_xml(model.get_state_name(id, s)) << "</OUTCOME>\n";
+				}
+				out << "</VARIABLE>\n";
+			}
+
+			for (id = 0; id < model.num_nodes(); ++id)
+			{
+				const vector<int>& parents = model.get_parents(id);
+				out << "<DEFINITION>\n";
+				out << "\t<FOR>" << escape_xml(model.get_node_name(id)) << "</FOR>\n";
+				for (size_t p = 0; p < parents.size(); ++p)
+				{
+					out << "\t<GIVEN>" << escape_xml(model.get_node_name(parents[p])) << "</GIVEN>\n";
+				}
+				out << "\t<TABLE>";
+				bool first = true;
+				visit_rows(model, id, [&](const vector<int>&, const vector<double>& row)
+				{
+					for (size_t s = 0; s < row.size(); ++s)
+					{
+						out << (first ? "" : " ") << format_number(row[s]);
+						first = false;
+					}
+				});
+				out << "</TABLE>\n</DEFINITION>\n";
+			}
+			out << "</NETWORK>\n</BIF>\n";
+		}
+
+
+		void write_hugin(std::ostream& out, const CompiledNet& model)
+		{
+			out << "net\n{\n}\n";
+
+			int id;
+			for (id = 0; id < model.num_nodes(); ++id)
+			{
+				out << "\nnode " << quote(model.get_node_name(id)) << "\n{\n\tstates = (";
+				for (int s = 0; s < model.get_num_states(id); ++s)
+				{
+					out << (s > 0 ? " " : "") << quote(model.get_state_name(id, s));
+				}
+				out << ");\n}\n";
+			}
+
+			for (id = 0; id < model.num_nodes(); ++id)
+			{
+				const vector<int>& parents = model.get_parents(id);
+				out << "\npotential (" << quote(model.get_node_name(id));
+				for (size_t p = 0; p < parents.size(); ++p)
+				{
+					out << (p == 0 ? " | " : " ") << quote(model.get_node_name(parents[p]));
+				}
+				out << ")\n{\n\tdata = ";
+
+				// one level of parentheses per parent, opened and closed as the
+				// parent states roll over
+				visit_rows(model, id, [&](const vector<int>& states, const vector<double>& row)
+				{
+					int p = parents.size();
+					while (p > 0 && states[p - 1] == 0) --p;
+					if (p < (int)parents.size() && p > 0) out << " ";
+					for (size_t i = p; i < parents.size(); ++i) out << "(";
+					if (!parents.empty() && states.back() > 0) out << " ";
+					out << "(";
+					for (size_t s = 0; s < row.size(); ++s)
+					{
+						out << (s > 0 ? " " : "") << format_number(row[s]);
+					}
+					out << ")";
+					for (p = parents.size(); p > 0; --p)
+					{
+						if (states[p - 1] + 1 < model.get_num_states(parents[p - 1])) break;
+						out << ")";
+					}
+				});
+				out << ";\n}\n";
+			}
+		}
+
+	}
+
+
+	void Net::read(const string& filename) throw(runtime_error)
+	{
+		int format = get_format(filename);
+		std::ifstream in(filename.c_str(), std::ios::binary);
+		if (!in) throw runtime_error("Unable to open " + filename);
+		read(in, format);
+	}
+
+
+	// Nothing is added to the network unless the whole file reads correctly.
+	void Net::read(std::istream& in, int format) throw(runtime_error)
+	{
+		ParsedNet parsed;
+		if (format == FORMAT_BIF) read_bif(in, parsed);
+		else if (format == FORMAT_XMLBIF) read_xmlbif(in, parsed);
+		else if (format == FORMAT_HUGIN) read_hugin(in, parsed);
+		else throw runtime_error("Invalid file format");
+		parsed.check_tables();
+
+		size_t n;
+		for (n = 0; n < parsed.nodes.size(); ++n)
+		{
+			if (m_nodes.count(parsed.nodes[n]->get_name()))
+				throw runtime_error("Network already has a node named " +
+				                    parsed.nodes[n]->get_name());
+		}
+		for (n = 0; n < parsed.nodes.size(); ++n)
+		{
+			m_owned_nodes.push_back(parsed.nodes[n]);
+			add_node(parsed.nodes[n].get());
+		}
+		if (!parsed.title.empty()) m_title = parsed.title;
+	}
+
+
+	void Net::write(const string& filename) throw(runtime_error)
+	{
+		int format = get_format(filename);
+		std::ofstream out(filename.c_str(), std::ios::binary | std::ios::trunc);
+		if (!out) throw runtime_error("Unable to open " + filename);
+		write(out, format);
+		out.close();
+		if (!out) throw runtime_error("Unable to write " + filename);
+	}
+
+
+	void Net::write(std::ostream& out, int format) throw(runtime_error)
+	{
+		shared_ptr<const CompiledNet> model = compile();
+		if (format == FORMAT_BIF) write_bif(out, *model, m_title);
+		else if (format == FORMAT_XMLBIF) write_xmlbif(out, *model, m_title);
+		else if (format == FORMAT_HUGIN) write_hugin(out, *model);
+		else throw runtime_error("Invalid file format");
+	}
+
+}
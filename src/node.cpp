@@ -25,17 +25,17 @@
 
 namespace sbn
 {
-	int Node::m_count = 0;
+	std::atomic<int> Node::m_count(0);
 
 
-	Node::Node(const string& name)
+	Node::Node(const string& name) : m_revision(0)
 	{
 		if (name.empty()) m_name = "Node" + std::to_string(++m_count);
 		else m_name = name;
 	}
 
 
-	Node::Node(const Node& node)
+	Node::Node(const Node& node) : m_revision(0)
 	{
 		*this = node;
 	}
@@ -46,231 +46,230 @@ namespace sbn
 		if (this != &node)
 		{
 			m_name = node.m_name;
-			m_probabilities = node.m_probabilities;
+			m_table = node.m_table;
 			m_parents = node.m_parents;
 			m_children = node.m_children;
 			m_states = node.m_states;
+			// never let the revision go down, or the sum that Net compares
+			// could come back to a value it had before
+			m_revision = std::max(m_revision, node.m_revision) + 1;
 		}
 		return *this;
 	}
 
 
-	string Node::get_name() const
+	const string& Node::get_name() const
 	{
 		return m_name;
 	}
 
 
+	// The new state is the last one of this node and of the matching parent in
+	// each child's table, and its entries start out at zero.
 	void Node::add_state(const string& name)
 	{
-		m_states.push_back(name);
+		if (m_states.find(name) >= 0) return;
+
+		vector<int> sizes = get_table_sizes();
+		vector< vector<int> > child_sizes;
+		NodeVector::iterator iter;
+		for (iter = m_children.begin(); iter != m_children.end(); ++iter)
+		{
+			child_sizes.push_back((*iter)->get_table_sizes());
+		}
+		m_states.intern(name);
+
+		remap_table(sizes, identity(sizes.size()));
+		for (size_t c = 0; c < m_children.size(); ++c)
+		{
+			m_children[c]->remap_table(child_sizes[c], identity(child_sizes[c].size()));
+		}
 	}
 
 
 	void Node::add_child(Node* child)
 	{
-		if (child == this) return;
-		m_children.push_back(child);
-		child->m_parents.push_back(this);
+		child->add_parent(this);
 	}
 
 
+	// The probabilities don't depend on the new parent yet, so every row is
+	// copied once for each of its states.
 	void Node::add_parent(Node* parent)
 	{
 		if (parent == this) return;
+		if (find(m_parents.begin(), m_parents.end(), parent) != m_parents.end())
+			return;
+
+		vector<int> sizes = get_table_sizes();
+		vector<int> sources = identity(sizes.size());
+		sources.push_back(-1);
 		m_parents.push_back(parent);
 		parent->m_children.push_back(this);
+		remap_table(sizes, sources);
+		parent->m_revision++;
 	}
 
 
-	// TODO: improve this method so that it recognizes when
-	// a node has probabilities set for all states but one
-	// and fills the last state in with (1 - sum_of_other_states)
-	void Node::set_probability(Event e, double prob)
+	void Node::remove_child(Node* child)
 	{
-		m_probabilities[e] = prob;
+		child->remove_parent(this);
 	}
 
 
-	// A node can't be evaluated unless its parent nodes have
-	// been observed
-	bool Node::can_be_evaluated(Event& evidence)
+	// Only the rows in which the removed parent is in its first state are kept.
+	void Node::remove_parent(Node* parent)
 	{
-		if (m_parents.empty()) return true;
-
-		for (NodeVector::iterator iter = m_parents.begin();
-		     iter != m_parents.end();
-		     ++iter)
-		{
-			if (!evidence.has_node((*iter)->get_name())) return false;
-		}
-
-		return true;
+		NodeVector::iterator iter = find(m_parents.begin(), m_parents.end(), parent);
+		if (iter == m_parents.end()) return;
+
+		vector<int> sizes = get_table_sizes();
+		vector<int> sources = identity(sizes.size());
+		sources.erase(sources.begin() + 1 + (iter - m_parents.begin()));
+		m_parents.erase(iter);
+		parent->m_children.erase(find(parent->m_children.begin(),
+		                              parent->m_children.end(), this));
+		remap_table(sizes, sources);
+		parent->m_revision++;
 	}
 
 
-	// In order to draw uniformly from the probabilty space, we can't
-	// just pick a random state.  Instead we generate a random number
-	// between zero and one and iterate through the states until the
-	// cumulative sum of their probabilities exceeds our random number.
-	string Node::get_random_state(Event& event)
+	// TODO: improve this method so that it recognizes when
+	// a node has probabilities set for all states but one
+	// and fills the last state in with (1 - sum_of_other_states)
+	void Node::set_probability(Event e, double prob) throw(runtime_error)
 	{
-		double sum = 0.0;
-		double num = ((double)random()) / RAND_MAX;
-		string random_state;
-
-		for (vector<string>::iterator iter = m_states.begin();
-		     iter != m_states.end();
-		     ++iter)
-		{
-			random_state = *iter;
-			sum += evaluate_marginal(random_state, event);
-			if (num < sum) break;
-		}
-
-		return random_state;
+		ObservationMap::iterator iter = e.m_observations.find(m_name);
+		if (iter == e.m_observations.end())
+			throw runtime_error("Event has no state for " + m_name);
+		m_table[get_table_index(iter->second, e.m_observations)] = prob;
+		m_revision++;
 	}
 
 
-	// similar to get_random_state() except it evaluates a node's markov
-	// blanket in addition to the node itself.
-	string Node::get_random_state_with_markov_blanket(Event& event)
+	void Node::set_probabilities(const vector<double>& table)
+		throw(runtime_error)
 	{
-		double sum = 0.0;
-		double num = ((double)random()) / RAND_MAX;
-		vector<double> evaluations;
-		string state;
-		vector<string>::iterator iter;
-
-		for (iter = m_states.begin(); iter != m_states.end(); ++iter)
-		{
-			double temp = evaluate_markov_blanket(*iter, event);
-			evaluations.push_back(temp);
-		}
+		if (table.size() != m_table.size())
+			throw runtime_error("Probability table has the wrong size");
+		m_table = table;
+		m_revision++;
+	}
 
-		// normalize results
-		double magnitude = 0.0;
-		vector<double>::iterator num_iter;
-		for (num_iter = evaluations.begin(); num_iter != evaluations.end(); ++num_iter)
-		{
-			magnitude += *num_iter;
-		}
-		transform(evaluations.begin(),
-		          evaluations.end(),
-		          evaluations.begin(),
-		          std::bind2nd(std::divides<double>(), magnitude));
 
-		num_iter = evaluations.begin();
-		for (iter = m_states.begin(); iter != m_states.end(); ++iter)
-		{
-			state = *iter;
-			sum += *num_iter;
-			if (num < sum) break;
-			++num_iter;
-		}
-
-		return state;
+	const vector<double>& Node::get_probabilities()
+	{
+		return m_table;
 	}
 
 
-	double Node::evaluate_marginal(const string& state, Event& event)
-		throw(runtime_error)
+	// Returns the number of states of this node followed by those of each of
+	// its parents, which are the dimensions of the table from the most to the
+	// least significant
+	vector<int> Node::get_table_sizes() const
 	{
-		ProbabilityMap prob = m_probabilities;
-		ProbabilityMap::iterator iter;
-		double returnval = 0.0;
-
-		remove_irrelevant_states(prob, state, event);
-		for (iter = prob.begin(); iter != prob.end(); ++iter)
+		vector<int> returnval(1, m_states.size());
+		for (NodeVector::const_iterator iter = m_parents.begin();
+		     iter != m_parents.end();
+		     ++iter)
 		{
-			returnval += iter->second;
+			returnval.push_back((*iter)->m_states.size());
 		}
-
 		return returnval;
 	}
 
 
-	double Node::evaluate_markov_blanket(const string& state, Event& event)
-		throw(runtime_error)
+	vector<int> Node::identity(size_t size)
 	{
-		ProbabilityMap prob = m_probabilities;
-		ProbabilityMap::iterator iter;
-		double returnval = 1.0;
-
-		remove_irrelevant_states(prob, state, event);
-		string temp = event.get_node_state(m_name);
-		event.set_node(m_name, state);
-		returnval *= evaluate_marginal(state, event);
-		NodeVector::iterator node_iter;
-
-		string childname;
-		for (node_iter = m_children.begin(); node_iter != m_children.end(); ++node_iter)
-		{
-			childname = (*node_iter)->get_name();
-			returnval *= (*node_iter)->evaluate_marginal(event.get_node_state(childname),
-			                                             event);
-		}
-		event.set_node(m_name, temp);
-
+		vector<int> returnval(size);
+		for (size_t i = 0; i < size; ++i) returnval[i] = i;
 		return returnval;
 	}
 
 
-	void Node::remove_irrelevant_states(ProbabilityMap& prob,
-	                                    const string& state,
-	                                    Event& evidence) throw(runtime_error)
+	// Lays the table out again after the structure has changed.  old_sizes
+	// gives the dimensions the table had, and sources[d] the old dimension
+	// that the current dimension d was (see get_table_sizes()), or -1 for a new
+	// parent that the entries are copied across.  States beyond the old ones
+	// get zeros, and an old dimension left out of sources is read at its first
+	// state.
+	void Node::remap_table(const vector<int>& old_sizes, const vector<int>& sources)
 	{
-		// TODO: switch this over to use STL algorithms (remove_if)
-
-		// remove probabilities that don't have the state we're looking for
-		ProbabilityMap::iterator i, j;
-		Event e;
-
-		i = prob.begin();
-		while (i != prob.end())
+		vector<int> sizes = get_table_sizes();
+		size_t size = 1;
+		for (size_t d = 0; d < sizes.size(); ++d) size *= sizes[d];
+
+		vector<double> table(size, 0.0);
+		vector<int> digits(sizes.size(), 0);
+		vector<int> old_digits(old_sizes.size());
+		for (size_t index = 0; index < size && !m_table.empty(); ++index)
 		{
-			e = i->first;
+			fill(old_digits.begin(), old_digits.end(), 0);
+			bool added = false;
+			for (size_t d = 0; d < sizes.size(); ++d)
+			{
+				if (sources[d] < 0) continue;
+				if (digits[d] >= old_sizes[sources[d]]) added = true;
+				else old_digits[sources[d]] = digits[d];
+			}
+			if (!added)
+			{
+				size_t old_index = 0;
+				for (size_t d = 0; d < old_sizes.size(); ++d)
+				{
+					old_index = old_index * old_sizes[d] + old_digits[d];
+				}
+				table[index] = m_table[old_index];
+			}
 
-			if (!e.node_has_state(m_name, state))
+			for (int d = sizes.size() - 1; d >= 0; --d)
 			{
-				prob.erase(i++);
+				if (++digits[d] < sizes[d]) break;
+				digits[d] = 0;
 			}
-			else ++i;
 		}
+		m_table.swap(table);
+		m_revision++;
+	}
 
-		string parentname;
-		NodeVector::iterator parent_iter;
-		for (parent_iter = m_parents.begin();
-		     parent_iter != m_parents.end(); ++parent_iter)
-		{
-			parentname = (*parent_iter)->get_name();
 
-			if (!evidence.has_node(parentname))
-				throw runtime_error("Marginal cannot be evaluated");
+	// Returns the position of P(state | parents) in the table, taking the parent
+	// states from the observations.
+	int Node::get_table_index(const string& state,
+	                          const ObservationMap& observations) const
+		throw(runtime_error)
+	{
+		int index = 0;
+		int stride = 1;
 
-			// remove irrelevant parent states
-			i = prob.begin();
-			while (i != prob.end())
-			{
-				e = i->first;
-				if (!e.node_has_state(parentname,
-				                      evidence.get_node_state(parentname)))
-				{
-					prob.erase(i++);
-				}
-				else ++i;
-			}
+		for (NodeVector::const_reverse_iterator iter = m_parents.rbegin();
+		     iter != m_parents.rend();
+		     ++iter)
+		{
+			const Node *parent = *iter;
+			ObservationMap::const_iterator found =
+				observations.find(parent->m_name);
+			if (found == observations.end())
+				throw runtime_error("Event has no state for " + parent->m_name);
+
+			int parent_state = parent->m_states.find(found->second);
+			if (parent_state < 0) throw runtime_error("Event contains invalid state");
+			index += parent_state * stride;
+			stride *= parent->m_states.size();
 		}
+
+		int own_state = m_states.find(state);
+		if (own_state < 0) throw runtime_error("Event contains invalid state");
+		return index + own_state * stride;
 	}
 
 
 	Event& Node::next_combination(Event& event) throw(runtime_error)
 	{
 		Node *parent;
-		string current_state;
+		int state;
 		bool flipped = false;
 		bool changed_state = false;
-		vector<string>::iterator i, start, end;
 
 		// Go through the parents in reverse order, incrementing each state.  If a
 		// state is at the end of its list, reset it back to its first state, move
@@ -281,19 +280,15 @@ namespace sbn
 			do
 			{
 				parent = *iter;
-				current_state = event.get_node_state(parent->m_name);
-				start = parent->m_states.begin();
-				end = parent->m_states.end();
-				i = find(start, end, current_state);
-				if (i == end) throw runtime_error("Event contains invalid state");
-				if (++i == end)
+				state = parent->m_states.find(event.get_node_state(parent->m_name));
+				if (state < 0) throw runtime_error("Event contains invalid state");
+				if (++state == parent->m_states.size())
 				{
-					i = start;
-					if (i == end) throw runtime_error("Encountered stateless node");
+					state = 0;
 					flipped = true;
 				}
 				else flipped = false;
-				event.set_node(parent->m_name, *i);
+				event.set_node(parent->m_name, parent->m_states.get_name(state));
 				changed_state = true;
 				iter++;
 			} while (iter != m_parents.rend() && flipped);
@@ -303,17 +298,10 @@ namespace sbn
 		// yet changed a state, we need to increment the current node's state.
 		if (flipped || !changed_state)
 		{
-			start = m_states.begin();
-			end = m_states.end();
-			current_state = event.get_node_state(m_name);
-			i = find(start, end, current_state);
-			if (i == end) throw runtime_error("Event contains invalid state");
-			if (++i == end)
-			{
-				i = start;
-				if (i == end) throw runtime_error("Encountered stateless node");
-			}
-			event.set_node(m_name, *i);
+			state = m_states.find(event.get_node_state(m_name));
+			if (state < 0) throw runtime_error("Event contains invalid state");
+			if (++state == m_states.size()) state = 0;
+			event.set_node(m_name, m_states.get_name(state));
 		}
 
 		return event;
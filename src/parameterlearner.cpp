@@ -0,0 +1,238 @@
+/*
+ * parameterlearner.cpp - Implementation of sbn::ParameterLearner class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	ParameterLearner::ParameterLearner(shared_ptr<const CompiledNet> model)
+		: m_model(model), m_num_rows(0), m_counts(model->num_nodes()),
+		  m_strides(model->num_nodes())
+	{
+		for (int id = 0; id < model->num_nodes(); ++id)
+		{
+			const vector<int>& parents = model->get_parents(id);
+			vector<int>& strides = m_strides[id];
+			strides.resize(parents.size() + 1);
+			int size = 1;
+			for (int p = parents.size() - 1; p >= 0; --p)
+			{
+				strides[p + 1] = size;
+				size *= model->get_num_states(parents[p]);
+			}
+			strides[0] = size;
+			m_counts[id].assign(size * model->get_num_states(id), 0.0);
+		}
+	}
+
+
+	shared_ptr<const CompiledNet> ParameterLearner::get_model() const
+	{
+		return m_model;
+	}
+
+
+	// The batch is turned back into rows, so that each row is looked up once
+	// per node rather than once per node and parent column.
+	void ParameterLearner::add(const EvidenceBatch& batch)
+	{
+		int rows = batch.num_rows();
+		Assignment row(m_model->num_nodes(), STATE_UNSET);
+		for (int r = 0; r < rows; ++r)
+		{
+			batch.get_row(r, row);
+			for (size_t c = 0; c < batch.nodes.size(); ++c)
+			{
+				int index = get_family_index(batch.nodes[c], row);
+				if (index >= 0) m_counts[batch.nodes[c]][index] += 1;
+			}
+		}
+		m_num_rows += rows;
+	}
+
+
+	void ParameterLearner::add(DataReader& reader, ThreadPool& pool)
+		throw(runtime_error)
+	{
+		add(reader, pool, false);
+	}
+
+
+	// Families that the row observes completely are counted directly, so the
+	// tree is only calibrated for rows with missing values, and only consulted
+	// for the families those values fall in.
+	void ParameterLearner::add_expected(const EvidenceBatch& batch,
+	                                    JunctionTree& tree) throw(runtime_error)
+	{
+		int num_nodes = m_model->num_nodes();
+		int rows = batch.num_rows();
+		Assignment row(num_nodes, STATE_UNSET);
+		for (int r = 0; r < rows; ++r)
+		{
+			batch.get_row(r, row);
+			bool complete = std::find(row.begin(), row.end(), STATE_UNSET) == row.end();
+			if (!complete) tree.calibrate(row);
+			for (int id = 0; id < num_nodes; ++id)
+			{
+				int index = get_family_index(id, row);
+				if (index >= 0)
+				{
+					m_counts[id][index] += 1;
+					continue;
+				}
+				vector<double> family = tree.get_family_marginal(id);
+				kernels::add(&m_counts[id][0], &family[0], family.size());
+			}
+		}
+		m_num_rows += rows;
+	}
+
+
+	void ParameterLearner::add_expected(DataReader& reader, ThreadPool& pool)
+		throw(runtime_error)
+	{
+		add(reader, pool, true);
+	}
+
+
+	// Returns the index of a row's family in the node's table, or -1 if the
+	// node or one of its parents is unobserved.
+	int ParameterLearner::get_family_index(int id, const Assignment& row) const
+	{
+		if (row[id] == STATE_UNSET) return -1;
+
+		const vector<int>& parents = m_model->get_parents(id);
+		const vector<int>& strides = m_strides[id];
+		int index = row[id] * strides[0];
+		for (size_t p = 0; p < parents.size(); ++p)
+		{
+			if (row[parents[p]] == STATE_UNSET) return -1;
+			index += row[parents[p]] * strides[p + 1];
+		}
+		return index;
+	}
+
+
+	// Every worker loops taking the next block off the reader, which is the
+	// only step that has to be taken in turn, then parses and counts it into
+	// its own learner.  Reading therefore overlaps with parsing, and the
+	// workers never contend for the counts.  For expected counts each worker
+	// also builds its own junction tree the first time it needs one.
+	void ParameterLearner::add(DataReader& reader, ThreadPool& pool,
+	                           bool expected) throw(runtime_error)
+	{
+		int num_workers = pool.num_threads();
+		vector<ParameterLearner> learners(num_workers, ParameterLearner(m_model));
+		vector< shared_ptr<JunctionTree> > trees(num_workers);
+		std::mutex mutex;
+		bool failed = false;
+
+		ThreadPool::Task task = [&](int, int worker)
+		{
+			string text;
+			long line;
+			EvidenceBatch batch;
+			while (true)
+			{
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					if (failed || !reader.next_block(text, line)) return;
+				}
+				try
+				{
+					reader.parse(text, line, batch);
+					if (!expected)
+					{
+						learners[worker].add(batch);
+						continue;
+					}
+					if (!trees[worker]) trees[worker].reset(new JunctionTree(*m_model));
+					learners[worker].add_expected(batch, *trees[worker]);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					failed = true;
+					throw;
+				}
+			}
+		};
+		pool.run(num_workers, task);
+
+		for (int w = 0; w < num_workers; ++w) merge(learners[w]);
+	}
+
+
+	void ParameterLearner::merge(const ParameterLearner& learner)
+	{
+		for (size_t id = 0; id < m_counts.size(); ++id)
+		{
+			if (m_counts[id].empty()) continue;
+			kernels::add(&m_counts[id][0], &learner.m_counts[id][0],
+			             m_counts[id].size());
+		}
+		m_num_rows += learner.m_num_rows;
+	}
+
+
+	double ParameterLearner::get_num_rows() const
+	{
+		return m_num_rows;
+	}
+
+
+	const vector<double>& ParameterLearner::get_counts(int id) const
+	{
+		return m_counts[id];
+	}
+
+
+	vector<double> ParameterLearner::get_table(int id, double prior) const
+		throw(runtime_error)
+	{
+		if (prior < 0) throw runtime_error("Prior must not be negative");
+
+		// the rows for a combination of parent states are strides[0] apart
+		vector<double> returnval = m_counts[id];
+		int num_states = m_model->get_num_states(id);
+		int combinations = m_strides[id][0];
+		for (int c = 0; c < combinations; ++c)
+		{
+			double magnitude = 0;
+			for (int s = 0; s < num_states; ++s)
+			{
+				returnval[s * combinations + c] += prior;
+				magnitude += returnval[s * combinations + c];
+			}
+			for (int s = 0; s < num_states; ++s)
+			{
+				returnval[s * combinations + c] = magnitude > 0 ?
+					returnval[s * combinations + c] / magnitude : 1.0 / num_states;
+			}
+		}
+		return returnval;
+	}
+
+}
@@ -0,0 +1,162 @@
+/*
+ * querycache.cpp - Implementation of sbn::QueryCache class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	QueryCache::QueryCache(size_t capacity) : m_capacity(capacity)
+	{
+	}
+
+
+	void QueryCache::set_capacity(size_t capacity)
+	{
+		m_capacity = capacity;
+		evict();
+	}
+
+
+	size_t QueryCache::get_capacity() const
+	{
+		return m_capacity;
+	}
+
+
+	size_t QueryCache::size() const
+	{
+		return m_entries.size();
+	}
+
+
+	bool QueryCache::find(const Event& evidence, const vector<int>& ids,
+	                      int mode, const QueryOptions& options,
+	                      vector< vector<double> >& result)
+	{
+		if (m_capacity == 0) return false;
+
+		size_t hash = get_hash(evidence, ids, mode, options);
+		EntryIndex::iterator found = find_entry(hash, evidence, ids, mode, options);
+		if (found == m_index.end()) return false;
+
+		// move it to the front, which keeps the iterators valid
+		m_entries.splice(m_entries.begin(), m_entries, found->second);
+		result = found->second->result;
+		return true;
+	}
+
+
+	void QueryCache::insert(const Event& evidence, const vector<int>& ids,
+	                        int mode, const QueryOptions& options,
+	                        const vector< vector<double> >& result)
+	{
+		if (m_capacity == 0) return;
+
+		size_t hash = get_hash(evidence, ids, mode, options);
+		EntryIndex::iterator found = find_entry(hash, evidence, ids, mode, options);
+		if (found != m_index.end())
+		{
+			found->second->result = result;
+			m_entries.splice(m_entries.begin(), m_entries, found->second);
+			return;
+		}
+
+		Entry entry;
+		entry.hash = hash;
+		entry.evidence = evidence;
+		entry.ids = ids;
+		entry.mode = mode;
+		entry.options = options;
+		entry.result = result;
+		m_entries.push_front(entry);
+		m_index.insert(std::make_pair(hash, m_entries.begin()));
+		evict();
+	}
+
+
+	void QueryCache::clear()
+	{
+		m_entries.clear();
+		m_index.clear();
+	}
+
+
+	size_t QueryCache::get_hash(const Event& evidence, const vector<int>& ids,
+	                            int mode, const QueryOptions& options)
+	{
+		size_t returnval = evidence.hash();
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			returnval = returnval * 31 + ids[i];
+		}
+		returnval = returnval * 31 + mode;
+		returnval = returnval * 31 + options.num_samples;
+		returnval = returnval * 31 + options.burn_in;
+		returnval = returnval * 31 + options.thinning;
+		returnval = returnval * 31 + options.num_chains;
+		returnval = returnval * 31 + options.prune;
+		returnval = returnval * 31 + std::hash<double>()(options.time_limit);
+		return returnval;
+	}
+
+
+	QueryCache::EntryIndex::iterator QueryCache::find_entry(size_t hash,
+	                                                        const Event& evidence,
+	                                                        const vector<int>& ids,
+	                                                        int mode,
+	                                                        const QueryOptions& options)
+	{
+		std::pair<EntryIndex::iterator, EntryIndex::iterator> range =
+			m_index.equal_range(hash);
+		for (EntryIndex::iterator iter = range.first; iter != range.second; ++iter)
+		{
+			const Entry& entry = *iter->second;
+			if (entry.mode == mode && entry.ids == ids && entry.options == options &&
+			    entry.evidence == evidence)
+				return iter;
+		}
+		return m_index.end();
+	}
+
+
+	void QueryCache::evict()
+	{
+		while (m_entries.size() > m_capacity)
+		{
+			EntryList::iterator last = --m_entries.end();
+			std::pair<EntryIndex::iterator, EntryIndex::iterator> range =
+				m_index.equal_range(last->hash);
+			for (EntryIndex::iterator iter = range.first; iter != range.second; ++iter)
+			{
+				if (iter->second == last)
+				{
+					m_index.erase(iter);
+					break;
+				}
+			}
+			m_entries.pop_back();
+		}
+	}
+
+}
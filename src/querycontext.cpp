@@ -0,0 +1,316 @@
+/*
+ * querycontext.cpp - Implementation of sbn::QueryContext class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	QueryContext::QueryContext(shared_ptr<const CompiledNet> model, int mode,
+	                           unsigned long long seed) throw(runtime_error)
+		: m_random(seed)
+	{
+		set_inference_mode(mode);
+		set_model(model);
+	}
+
+
+	QueryContext::QueryContext(const QueryContext& context)
+	{
+		*this = context;
+	}
+
+
+	QueryContext& QueryContext::operator=(const QueryContext& context)
+	{
+		if (this != &context)
+		{
+			m_model = context.m_model;
+			m_inference_mode = context.m_inference_mode;
+			m_evidence = context.m_evidence;
+			m_random = context.m_random;
+			m_chains = context.m_chains;
+
+			// a calibrated tree is scratch space, which is never shared
+			m_junction_tree.reset();
+			m_pruned.reset();
+		}
+		return *this;
+	}
+
+
+	shared_ptr<const CompiledNet> QueryContext::get_model() const
+	{
+		return m_model;
+	}
+
+
+	void QueryContext::set_model(shared_ptr<const CompiledNet> model)
+	{
+		m_model = model;
+		m_evidence.assign(model ? model->num_nodes() : 0, STATE_UNSET);
+		m_junction_tree.reset();
+		m_chains.clear();
+		m_pruned.reset();
+	}
+
+
+	void QueryContext::set_inference_mode(int mode) throw(runtime_error)
+	{
+		if (mode < INFERENCE_MODE_EXACT || mode > INFERENCE_MODE_JUNCTION_TREE)
+			throw runtime_error("Invalid inference mode");
+		m_inference_mode = mode;
+	}
+
+
+	int QueryContext::get_inference_mode() const
+	{
+		return m_inference_mode;
+	}
+
+
+	void QueryContext::set_evidence(const Event& e) throw(runtime_error)
+	{
+		if (!m_model) throw runtime_error("Query context has no network");
+		m_evidence = m_model->to_assignment(e);
+	}
+
+
+	void QueryContext::set_evidence(const Assignment& evidence)
+		throw(runtime_error)
+	{
+		if (!m_model) throw runtime_error("Query context has no network");
+		if ((int)evidence.size() != m_model->num_nodes())
+			throw runtime_error("Evidence doesn't match the network");
+		for (size_t id = 0; id < evidence.size(); ++id)
+		{
+			if (evidence[id] != STATE_UNSET &&
+			    (evidence[id] < 0 || evidence[id] >= m_model->get_num_states(id)))
+				throw runtime_error("Invalid state");
+		}
+		m_evidence = evidence;
+	}
+
+
+	const Assignment& QueryContext::get_evidence() const
+	{
+		return m_evidence;
+	}
+
+
+	void QueryContext::add_evidence(int id, int state) throw(runtime_error)
+	{
+		if (!m_model) throw runtime_error("Query context has no network");
+		if (id < 0 || id >= m_model->num_nodes()) throw runtime_error("Invalid node");
+		if (state < 0 || state >= m_model->get_num_states(id))
+			throw runtime_error("Invalid state");
+		m_evidence[id] = state;
+	}
+
+
+	void QueryContext::retract_evidence(int id) throw(runtime_error)
+	{
+		if (!m_model) throw runtime_error("Query context has no network");
+		if (id < 0 || id >= m_model->num_nodes()) throw runtime_error("Invalid node");
+		m_evidence[id] = STATE_UNSET;
+	}
+
+
+	RandomEngine& QueryContext::get_random()
+	{
+		return m_random;
+	}
+
+
+	void QueryContext::seed(unsigned long long seed)
+	{
+		m_random.seed(seed);
+		m_chains.clear();
+	}
+
+
+	void QueryContext::set_random(const RandomEngine& rng)
+	{
+		m_random = rng;
+		m_chains.clear();
+	}
+
+
+	vector< vector<double> > QueryContext::query(const vector<int>& ids,
+	                                             const QueryOptions& options,
+	                                             ThreadPool *pool)
+		throw(runtime_error)
+	{
+		if (!m_model) throw runtime_error("Query context has no network");
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			if (ids[i] < 0 || ids[i] >= m_model->num_nodes())
+				throw runtime_error("Invalid node");
+		}
+
+		vector< vector<double> > returnval;
+		if (m_inference_mode == INFERENCE_MODE_JUNCTION_TREE)
+		{
+			// the tree stays calibrated, so further queries against the same
+			// evidence just read off another marginal
+			if (!m_junction_tree) m_junction_tree.reset(new JunctionTree(*m_model));
+			m_junction_tree->calibrate(m_evidence);
+			for (size_t i = 0; i < ids.size(); ++i)
+			{
+				returnval.push_back(m_junction_tree->get_marginal(ids[i]));
+			}
+			return returnval;
+		}
+
+		const CompiledNet *model = m_model.get();
+		const Assignment *evidence = &m_evidence;
+		vector<int> model_ids = ids;
+		Assignment pruned_evidence;
+		if (options.prune)
+		{
+			// the pruned model is kept for as long as the query stays the same
+			if (!m_pruned || m_pruned_ids != ids || m_pruned_evidence != m_evidence)
+			{
+				m_pruned.reset(new CompiledNet(m_model->prune(ids, m_evidence,
+				                                              m_pruned_mapping)));
+				m_pruned_ids = ids;
+				m_pruned_evidence = m_evidence;
+			}
+			model = m_pruned.get();
+			pruned_evidence.assign(model->num_nodes(), STATE_UNSET);
+			for (size_t id = 0; id < m_evidence.size(); ++id)
+			{
+				if (m_pruned_mapping[id] >= 0)
+					pruned_evidence[m_pruned_mapping[id]] = m_evidence[id];
+			}
+			evidence = &pruned_evidence;
+			for (size_t i = 0; i < ids.size(); ++i)
+			{
+				model_ids[i] = m_pruned_mapping[ids[i]];
+			}
+		}
+
+		if (m_inference_mode == INFERENCE_MODE_EXACT)
+		{
+			VariableElimination engine(*model);
+			for (size_t i = 0; i < model_ids.size(); ++i)
+			{
+				returnval.push_back(engine.query(model_ids[i], *evidence));
+			}
+		}
+		else if (m_inference_mode == INFERENCE_MODE_REJECTION_SAMPLING)
+		{
+			ForwardSampler engine(*model);
+			returnval = engine.rejection_sampling(model_ids, *evidence, options,
+			                                      m_random);
+		}
+		else if (m_inference_mode == INFERENCE_MODE_LIKELIHOOD_WEIGHTING)
+		{
+			ForwardSampler engine(*model);
+			returnval = engine.likelihood_weighting(model_ids, *evidence, options,
+			                                        m_random);
+		}
+		else
+		{
+			// the chains carry on from where the last query left them, mapped
+			// onto the pruned model if there is one
+			GibbsSampler engine(*model);
+			int num_chains = pool && options.num_chains > 1 ? options.num_chains : 1;
+			vector<Assignment> states(num_chains);
+			m_chains.resize(num_chains);
+			for (int c = 0; c < num_chains; ++c)
+			{
+				if (m_chains[c].empty()) m_chains[c].assign(m_model->num_nodes(), STATE_UNSET);
+				if (!options.prune) states[c] = m_chains[c];
+				else
+				{
+					states[c].assign(model->num_nodes(), STATE_UNSET);
+					for (size_t id = 0; id < m_chains[c].size(); ++id)
+					{
+						if (m_pruned_mapping[id] >= 0)
+							states[c][m_pruned_mapping[id]] = m_chains[c][id];
+					}
+				}
+			}
+
+			if (num_chains > 1)
+				returnval = engine.query(model_ids, *evidence, options, *pool, m_random,
+				                         states);
+			else
+				returnval = engine.query(model_ids, *evidence, options, m_random,
+				                         states[0]);
+
+			for (int c = 0; c < num_chains; ++c)
+			{
+				if (!options.prune) m_chains[c] = states[c];
+				else
+				{
+					for (size_t id = 0; id < m_chains[c].size(); ++id)
+					{
+						if (m_pruned_mapping[id] >= 0)
+							m_chains[c][id] = states[c][m_pruned_mapping[id]];
+					}
+				}
+			}
+		}
+
+		return returnval;
+	}
+
+
+	StateProbabilityMap QueryContext::query_node(const string& nodename,
+	                                             const QueryOptions& options)
+		throw(runtime_error)
+	{
+		if (!m_model) throw runtime_error("Query context has no network");
+		int id = m_model->get_node_id(nodename);
+		vector<double> posterior = query(vector<int>(1, id), options)[0];
+
+		StateProbabilityMap returnval;
+		for (size_t s = 0; s < posterior.size(); ++s)
+		{
+			returnval[m_model->get_state_name(id, s)] = posterior[s];
+		}
+		return returnval;
+	}
+
+
+	Assignment QueryContext::query_map(const vector<int>& ids) throw(runtime_error)
+	{
+		if (!m_model) throw runtime_error("Query context has no network");
+		if (ids.empty()) return Assignment(m_model->num_nodes(), STATE_UNSET);
+
+		Assignment best = VariableElimination(*m_model).maximize(ids, m_evidence);
+		Assignment returnval(m_model->num_nodes(), STATE_UNSET);
+		for (size_t i = 0; i < ids.size(); ++i) returnval[ids[i]] = best[ids[i]];
+		return returnval;
+	}
+
+
+	Assignment QueryContext::query_mpe() throw(runtime_error)
+	{
+		if (!m_model) throw runtime_error("Query context has no network");
+		return VariableElimination(*m_model).maximize(vector<int>(), m_evidence);
+	}
+
+}
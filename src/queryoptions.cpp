@@ -0,0 +1,59 @@
+/*
+ * queryoptions.cpp - Implementation of sbn::QueryOptions struct
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	QueryOptions::QueryOptions()
+		: num_samples(MCMC_NUM_SAMPLES),
+		  burn_in(0),
+		  thinning(1),
+		  num_chains(1),
+		  prune(true),
+		  time_limit(0.0)
+	{
+	}
+
+
+	bool QueryOptions::operator==(const QueryOptions& options) const
+	{
+		return num_samples == options.num_samples &&
+		       burn_in == options.burn_in &&
+		       thinning == options.thinning &&
+		       num_chains == options.num_chains &&
+		       prune == options.prune &&
+		       time_limit == options.time_limit;
+	}
+
+
+	std::chrono::steady_clock::time_point QueryOptions::get_deadline() const
+	{
+		typedef std::chrono::steady_clock Clock;
+		if (time_limit <= 0.0) return Clock::time_point::max();
+		return Clock::now() + std::chrono::duration_cast<Clock::duration>(
+			std::chrono::duration<double>(time_limit));
+	}
+
+}
@@ -0,0 +1,110 @@
+/*
+ * randomengine.cpp - Implementation of sbn::RandomEngine class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	static inline RandomEngine::result_type rotate(RandomEngine::result_type x,
+	                                               int k)
+	{
+		return (x << k) | (x >> (64 - k));
+	}
+
+
+	RandomEngine::RandomEngine(result_type seed)
+	{
+		this->seed(seed);
+	}
+
+
+	// The state is filled in with splitmix64, as the xoshiro authors recommend,
+	// so that similar seeds still give unrelated streams and the state is never
+	// all zeros.
+	void RandomEngine::seed(result_type seed)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			result_type z = (seed += 0x9e3779b97f4a7c15ULL);
+			z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+			m_state[i] = z ^ (z >> 31);
+		}
+	}
+
+
+	RandomEngine::result_type RandomEngine::operator()()
+	{
+		result_type returnval = rotate(m_state[1] * 5, 7) * 9;
+		result_type t = m_state[1] << 17;
+
+		m_state[2] ^= m_state[0];
+		m_state[3] ^= m_state[1];
+		m_state[1] ^= m_state[2];
+		m_state[0] ^= m_state[3];
+		m_state[2] ^= t;
+		m_state[3] = rotate(m_state[3], 45);
+
+		return returnval;
+	}
+
+
+	// the top 53 bits fill a double's mantissa exactly
+	double RandomEngine::next_double()
+	{
+		return ((*this)() >> 11) * (1.0 / 9007199254740992.0);
+	}
+
+
+	void RandomEngine::jump()
+	{
+		static const result_type polynomial[] = { 0x180ec6d33cfd0abaULL,
+		                                          0xd5a61266f0c9392cULL,
+		                                          0xa9582618e03fc9aaULL,
+		                                          0x39abdc4529b1661cULL };
+		result_type state[4] = { 0, 0, 0, 0 };
+
+		for (int i = 0; i < 4; ++i)
+		{
+			for (int b = 0; b < 64; ++b)
+			{
+				if (polynomial[i] & (1ULL << b))
+				{
+					for (int j = 0; j < 4; ++j) state[j] ^= m_state[j];
+				}
+				(*this)();
+			}
+		}
+		for (int j = 0; j < 4; ++j) m_state[j] = state[j];
+	}
+
+
+	RandomEngine RandomEngine::split()
+	{
+		RandomEngine returnval = *this;
+		jump();
+		return returnval;
+	}
+
+}
@@ -0,0 +1,433 @@
+/*
+ * structurelearner.cpp - Implementation of sbn::StructureLearner class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+
+#include "sbn.h"
+#include <deque>
+
+
+namespace sbn
+{
+
+	namespace
+	{
+
+		enum { MOVE_ADD, MOVE_REMOVE, MOVE_REVERSE };
+
+		// A change to a single link: adding the link from one node to another,
+		// removing it, or turning it around
+		struct Move
+		{
+			int type;
+			int from;
+			int to;
+		};
+
+		typedef std::pair< int, vector<int> > Family;
+
+
+		vector<int> with(vector<int> parents, int parent)
+		{
+			parents.insert(lower_bound(parents.begin(), parents.end(), parent),
+			               parent);
+			return parents;
+		}
+
+
+		vector<int> without(vector<int> parents, int parent)
+		{
+			parents.erase(find(parents.begin(), parents.end(), parent));
+			return parents;
+		}
+
+
+		// Appends the families a move changes, with their new parents
+		void get_families(const Move& move,
+		                  const vector< vector<int> >& parents,
+		                  vector<Family>& families)
+		{
+			if (move.type == MOVE_ADD)
+			{
+				families.push_back(Family(move.to, with(parents[move.to], move.from)));
+				return;
+			}
+			families.push_back(Family(move.to, without(parents[move.to], move.from)));
+			if (move.type == MOVE_REVERSE)
+				families.push_back(Family(move.from, with(parents[move.from], move.to)));
+		}
+
+	}
+
+
+	StructureLearner::StructureLearner(shared_ptr<const CompiledNet> model,
+	                                   const EvidenceBatch& data,
+	                                   const StructureOptions& options)
+		throw(runtime_error)
+		: m_model(model), m_data(data), m_options(options),
+		  m_columns(model->num_nodes(), -1), m_scores(model->num_nodes())
+	{
+		if (options.score != SCORE_BIC && options.score != SCORE_BDEU)
+			throw runtime_error("Invalid score");
+		if (options.score == SCORE_BDEU && options.equivalent_sample_size <= 0)
+			throw runtime_error("Equivalent sample size must be positive");
+		if (options.max_parents < 0)
+			throw runtime_error("Parent limit must not be negative");
+
+		data.validate(*model);
+		for (size_t c = 0; c < data.nodes.size(); ++c) m_columns[data.nodes[c]] = c;
+		for (int row = 0; row < data.num_rows(); ++row)
+		{
+			size_t c = 0;
+			while (c < data.columns.size() && data.columns[c][row] != STATE_UNSET) ++c;
+			if (c == data.columns.size()) m_rows.push_back(row);
+		}
+	}
+
+
+	double StructureLearner::get_score(int id, const vector<int>& parents)
+	{
+		vector<int> key = parents;
+		sort(key.begin(), key.end());
+		ScoreCache::iterator iter = m_scores[id].find(key);
+		if (iter != m_scores[id].end()) return iter->second;
+
+		double score = compute_score(id, key);
+		m_scores[id][key] = score;
+		return score;
+	}
+
+
+	double StructureLearner::get_score(const vector< vector<int> >& parents)
+	{
+		double returnval = 0;
+		for (size_t id = 0; id < parents.size(); ++id)
+		{
+			returnval += get_score(id, parents[id]);
+		}
+		return returnval;
+	}
+
+
+	size_t StructureLearner::get_cache_size() const
+	{
+		size_t returnval = 0;
+		for (size_t id = 0; id < m_scores.size(); ++id)
+		{
+			returnval += m_scores[id].size();
+		}
+		return returnval;
+	}
+
+
+	// Every step first gathers the families that the candidate moves would
+	// create and scores the ones that aren't cached on the pool.  The cache is
+	// only touched between those parallel passes, so it needs no locking, and
+	// ranking the moves is then a matter of lookups.
+	vector< vector<int> > StructureLearner::search(ThreadPool& pool)
+		throw(runtime_error)
+	{
+		int n = m_model->num_nodes();
+		vector< vector<int> > parents(n);
+		vector<Family> families;
+		for (int id = 0; id < n; ++id)
+		{
+			parents[id] = m_model->get_parents(id);
+			sort(parents[id].begin(), parents[id].end());
+			if ((int)parents[id].size() > m_options.max_parents)
+				throw runtime_error("Starting structure exceeds the parent limit");
+			families.push_back(Family(id, parents[id]));
+		}
+		cache_scores(families, pool);
+
+		vector<double> scores(n);
+		double total = 0;
+		for (int id = 0; id < n; ++id)
+		{
+			scores[id] = m_scores[id][parents[id]];
+			total += scores[id];
+		}
+		vector< vector<int> > best = parents;
+		double best_total = total;
+		std::deque< vector< vector<int> > > tabu;
+		int stall = 0;
+
+		for (int step = 0; step < m_options.max_iterations; ++step)
+		{
+			// reach[a][b] is set if there is a directed path from a to b
+			vector< vector<int> > children(n);
+			for (int id = 0; id < n; ++id)
+			{
+				for (size_t p = 0; p < parents[id].size(); ++p)
+				{
+					children[parents[id][p]].push_back(id);
+				}
+			}
+			vector< vector<bool> > reach(n, vector<bool>(n, false));
+			for (int a = 0; a < n; ++a)
+			{
+				vector<int> pending(1, a);
+				reach[a][a] = true;
+				while (!pending.empty())
+				{
+					int node = pending.back();
+					pending.pop_back();
+					for (size_t c = 0; c < children[node].size(); ++c)
+					{
+						int child = children[node][c];
+						if (reach[a][child]) continue;
+						reach[a][child] = true;
+						pending.push_back(child);
+					}
+				}
+			}
+
+			// every single change that keeps the graph acyclic and within the
+			// parent limit
+			vector<Move> moves;
+			for (int from = 0; from < n; ++from)
+			{
+				for (int to = 0; to < n; ++to)
+				{
+					if (from == to) continue;
+					if (!binary_search(parents[to].begin(), parents[to].end(), from))
+					{
+						if ((int)parents[to].size() < m_options.max_parents &&
+						    !reach[to][from])
+						{
+							Move move = { MOVE_ADD, from, to };
+							moves.push_back(move);
+						}
+						continue;
+					}
+
+					Move removal = { MOVE_REMOVE, from, to };
+					moves.push_back(removal);
+
+					// turning the link around closes a cycle if there is another
+					// path from its tail to its head
+					bool other_path = false;
+					for (size_t c = 0; c < children[from].size() && !other_path; ++c)
+					{
+						int child = children[from][c];
+						if (child != to && reach[child][to]) other_path = true;
+					}
+					if (!other_path && (int)parents[from].size() < m_options.max_parents)
+					{
+						Move reversal = { MOVE_REVERSE, from, to };
+						moves.push_back(reversal);
+					}
+				}
+			}
+			if (moves.empty()) break;
+
+			families.clear();
+			for (size_t m = 0; m < moves.size(); ++m)
+			{
+				get_families(moves[m], parents, families);
+			}
+			cache_scores(families, pool);
+
+			// A move leads back to a tabu structure if the nodes where that
+			// structure differs from the current one are among those the move
+			// changes, and get the same parents there.
+			vector< vector<int> > differences(tabu.size());
+			for (size_t t = 0; t < tabu.size(); ++t)
+			{
+				for (int id = 0; id < n; ++id)
+				{
+					if (tabu[t][id] != parents[id]) differences[t].push_back(id);
+				}
+			}
+
+			int chosen = -1;
+			double best_delta = 0;
+			for (size_t m = 0; m < moves.size(); ++m)
+			{
+				families.clear();
+				get_families(moves[m], parents, families);
+				bool revisits = false;
+				for (size_t t = 0; t < tabu.size() && !revisits; ++t)
+				{
+					size_t matched = 0;
+					for (size_t f = 0; f < families.size(); ++f)
+					{
+						int id = families[f].first;
+						if (tabu[t][id] == families[f].second) matched++;
+						else break;
+					}
+					revisits = matched == families.size() &&
+						differences[t].size() <= families.size();
+					for (size_t d = 0; d < differences[t].size() && revisits; ++d)
+					{
+						int id = differences[t][d];
+						revisits = id == families[0].first ||
+							(families.size() > 1 && id == families[1].first);
+					}
+				}
+				if (revisits) continue;
+
+				double delta = 0;
+				for (size_t f = 0; f < families.size(); ++f)
+				{
+					int id = families[f].first;
+					delta += m_scores[id][families[f].second] - scores[id];
+				}
+				if (chosen < 0 || delta > best_delta)
+				{
+					chosen = m;
+					best_delta = delta;
+				}
+			}
+
+			// differences this small come from rounding, as when a link is
+			// reversed within the same equivalence class
+			double epsilon = 1e-9 * std::max(1.0, std::fabs(total));
+			if (chosen < 0 || (m_options.tabu_size == 0 && best_delta <= epsilon))
+				break;
+
+			if (m_options.tabu_size > 0)
+			{
+				tabu.push_back(parents);
+				if ((int)tabu.size() > m_options.tabu_size) tabu.pop_front();
+			}
+
+			const Move& move = moves[chosen];
+			families.clear();
+			get_families(move, parents, families);
+			for (size_t f = 0; f < families.size(); ++f)
+			{
+				int id = families[f].first;
+				parents[id] = families[f].second;
+				scores[id] = m_scores[id][parents[id]];
+			}
+			total += best_delta;
+			if (total > best_total + epsilon)
+			{
+				best = parents;
+				best_total = total;
+				stall = 0;
+			}
+			else if (++stall >= m_options.tabu_size) break;
+		}
+
+		return best;
+	}
+
+
+	// Scores the families that aren't cached yet, one task per family.  Each
+	// task makes a single pass over the data.
+	void StructureLearner::cache_scores(const vector<Family>& families,
+	                                    ThreadPool& pool)
+	{
+		vector<Family> missing;
+		set<Family> seen;
+		for (size_t f = 0; f < families.size(); ++f)
+		{
+			const ScoreCache& cache = m_scores[families[f].first];
+			if (cache.find(families[f].second) != cache.end()) continue;
+			if (seen.insert(families[f]).second) missing.push_back(families[f]);
+		}
+
+		vector<double> scores(missing.size());
+		ThreadPool::Task task = [&](int f, int)
+		{
+			scores[f] = compute_score(missing[f].first, missing[f].second);
+		};
+		pool.run(missing.size(), task);
+
+		for (size_t f = 0; f < missing.size(); ++f)
+		{
+			m_scores[missing[f].first][missing[f].second] = scores[f];
+		}
+	}
+
+
+	// Counts the node's states under each combination of its parents' states
+	// in one pass over the data, then scores the counts.  Families with a node
+	// that has no column in the data score zero.
+	double StructureLearner::compute_score(int id, const vector<int>& parents) const
+	{
+		if (m_columns[id] < 0) return 0;
+		const vector<int>& states = m_data.columns[m_columns[id]];
+		int num_states = m_model->get_num_states(id);
+
+		vector<const int *> parent_states;
+		vector<int> cardinalities;
+		int combinations = 1;
+		for (size_t p = 0; p < parents.size(); ++p)
+		{
+			if (m_columns[parents[p]] < 0) return 0;
+			parent_states.push_back(m_data.columns[m_columns[parents[p]]].data());
+			cardinalities.push_back(m_model->get_num_states(parents[p]));
+			combinations *= cardinalities.back();
+		}
+
+		// counts[j * num_states + k] is the number of rows in which the parents
+		// are in their j-th combination and the node in state k
+		vector<double> counts(combinations * num_states, 0.0);
+		double total = m_rows.size();
+		for (size_t r = 0; r < m_rows.size(); ++r)
+		{
+			int row = m_rows[r];
+			int combination = 0;
+			for (size_t p = 0; p < parent_states.size(); ++p)
+			{
+				combination = combination * cardinalities[p] + parent_states[p][row];
+			}
+			counts[combination * num_states + states[row]] += 1;
+		}
+		if (total == 0) return 0;
+
+		double returnval = 0;
+		double ess = m_options.equivalent_sample_size;
+		for (int j = 0; j < combinations; ++j)
+		{
+			const double *row = &counts[j * num_states];
+			double magnitude = 0;
+			for (int k = 0; k < num_states; ++k) magnitude += row[k];
+			if (magnitude == 0) continue;
+
+			if (m_options.score == SCORE_BIC)
+			{
+				for (int k = 0; k < num_states; ++k)
+				{
+					if (row[k] > 0) returnval += row[k] * std::log(row[k] / magnitude);
+				}
+				continue;
+			}
+			double alpha = ess / combinations;
+			returnval += std::lgamma(alpha) - std::lgamma(alpha + magnitude);
+			for (int k = 0; k < num_states; ++k)
+			{
+				if (row[k] == 0) continue;
+				returnval += std::lgamma(alpha / num_states + row[k]) -
+					std::lgamma(alpha / num_states);
+			}
+		}
+		if (m_options.score == SCORE_BIC)
+		{
+			returnval -= 0.5 * std::log(total) * (num_states - 1) * combinations;
+		}
+		return returnval;
+	}
+
+}
@@ -0,0 +1,39 @@
+/*
+ * structureoptions.cpp - Implementation of sbn::StructureOptions struct
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	StructureOptions::StructureOptions()
+		: score(SCORE_BIC),
+		  equivalent_sample_size(1.0),
+		  max_parents(3),
+		  tabu_size(0),
+		  max_iterations(1000)
+	{
+	}
+
+}
@@ -0,0 +1,66 @@
+/*
+ * symboltable.cpp - Implementation of sbn::SymbolTable class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	int SymbolTable::intern(const string& name)
+	{
+		std::unordered_map<string, int>::const_iterator iter = m_symbols.find(name);
+		if (iter != m_symbols.end()) return iter->second;
+
+		int symbol = m_names.size();
+		m_names.push_back(name);
+		m_symbols[name] = symbol;
+		return symbol;
+	}
+
+
+	int SymbolTable::find(const string& name) const
+	{
+		std::unordered_map<string, int>::const_iterator iter = m_symbols.find(name);
+		if (iter == m_symbols.end()) return -1;
+		return iter->second;
+	}
+
+
+	const string& SymbolTable::get_name(int symbol) const
+	{
+		return m_names[symbol];
+	}
+
+
+	int SymbolTable::size() const
+	{
+		return m_names.size();
+	}
+
+
+	bool SymbolTable::empty() const
+	{
+		return m_names.empty();
+	}
+
+}
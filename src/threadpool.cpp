@@ -0,0 +1,109 @@
+/*
+ * threadpool.cpp - Implementation of sbn::ThreadPool class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	ThreadPool::ThreadPool(int num_threads)
+		: m_task(0), m_num_tasks(0), m_next_task(0), m_remaining(0),
+		  m_stopping(false)
+	{
+		if (num_threads <= 0) num_threads = std::thread::hardware_concurrency();
+		if (num_threads <= 0) num_threads = 1;
+		for (int i = 0; i < num_threads; ++i)
+		{
+			m_threads.push_back(std::thread(&ThreadPool::work, this, i));
+		}
+	}
+
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stopping = true;
+		}
+		m_wake.notify_all();
+		for (size_t i = 0; i < m_threads.size(); ++i) m_threads[i].join();
+	}
+
+
+	int ThreadPool::num_threads() const
+	{
+		return m_threads.size();
+	}
+
+
+	void ThreadPool::run(int num_tasks, const Task& task)
+	{
+		if (num_tasks <= 0) return;
+
+		// only one batch of tasks is handed out at a time
+		std::lock_guard<std::mutex> batch(m_run_mutex);
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_task = &task;
+		m_num_tasks = num_tasks;
+		m_next_task = 0;
+		m_remaining = num_tasks;
+		m_error = std::exception_ptr();
+		m_wake.notify_all();
+		m_done.wait(lock, [this] { return m_remaining == 0; });
+		m_task = 0;
+
+		if (m_error) std::rethrow_exception(m_error);
+	}
+
+
+	// Workers take the next task index under the lock and run it outside.  The
+	// first exception thrown by a task is handed back to run().
+	void ThreadPool::work(int worker)
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (true)
+		{
+			m_wake.wait(lock, [this] {
+				return m_stopping || (m_task && m_next_task < m_num_tasks);
+			});
+			if (m_stopping) return;
+
+			int index = m_next_task++;
+			const Task *task = m_task;
+			lock.unlock();
+			try
+			{
+				(*task)(index, worker);
+			}
+			catch (...)
+			{
+				lock.lock();
+				if (!m_error) m_error = std::current_exception();
+				lock.unlock();
+			}
+			lock.lock();
+			if (--m_remaining == 0) m_done.notify_all();
+		}
+	}
+
+}
@@ -0,0 +1,187 @@
+/*
+ * variableelimination.cpp - Implementation of sbn::VariableElimination class
+ *
+ * SBN - Simple Bayesian Networking library
+ * Copyright (c) 2005 Carl Youngblood
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2 of the License, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program; if not, write to the Free Software Foundation, Inc., 51
+ * Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA
+ */
+
+
+#include "sbn.h"
+
+
+namespace sbn
+{
+
+	VariableElimination::VariableElimination(const CompiledNet& model,
+	                                         int heuristic)
+		: m_model(model), m_heuristic(heuristic)
+	{
+	}
+
+
+	vector<double> VariableElimination::query(int id,
+	                                          const Assignment& evidence) const
+		throw(runtime_error)
+	{
+		int num_states = m_model.get_num_states(id);
+		vector<double> returnval(num_states, 0.0);
+
+		// an observed node is certain to be in its observed state
+		if (evidence[id] != STATE_UNSET)
+		{
+			returnval[evidence[id]] = 1.0;
+			return returnval;
+		}
+
+		// In the log domain every intermediate factor is scaled to sum to one.
+		// The answer is normalized at the end anyway, so the scale doesn't
+		// matter, and it keeps long products from underflowing.
+		bool rescale = m_model.is_log_domain();
+		vector<Factor> factors = get_factors(evidence);
+		vector<int> order =
+			m_model.get_elimination_order(evidence, vector<int>(1, id), m_heuristic);
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			eliminate(factors, order[i], false);
+		}
+
+		Factor result;
+		for (size_t f = 0; f < factors.size(); ++f)
+		{
+			result = result.product(factors[f]);
+			if (rescale) result.normalize();
+		}
+		if (result.normalize() <= 0.0)
+			throw runtime_error("Evidence has zero probability");
+
+		const vector<double>& values = result.get_values();
+		copy(values.begin(), values.end(), returnval.begin());
+		return returnval;
+	}
+
+
+	// Summing out the nodes that aren't asked for first leaves factors over the
+	// asked-for nodes only, which are then maxed out in the order the heuristic
+	// picked for them.  A scale on the factors doesn't move the maximum, so
+	// the log domain rescales them as query() does.
+	Assignment VariableElimination::maximize(const vector<int>& ids,
+	                                         const Assignment& evidence) const
+		throw(runtime_error)
+	{
+		int num_nodes = m_model.num_nodes();
+		vector<bool> wanted(num_nodes, ids.empty());
+		for (size_t i = 0; i < ids.size(); ++i)
+		{
+			if (ids[i] < 0 || ids[i] >= num_nodes) throw runtime_error("Invalid node");
+			wanted[ids[i]] = true;
+		}
+		vector<int> keep;
+		for (int id = 0; id < num_nodes; ++id)
+		{
+			if (wanted[id] && evidence[id] == STATE_UNSET) keep.push_back(id);
+		}
+
+		vector<Factor> factors = get_factors(evidence);
+		vector<int> order = m_model.get_elimination_order(evidence, keep, m_heuristic);
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			eliminate(factors, order[i], false);
+		}
+
+		vector<int> max_order;
+		order = m_model.get_elimination_order(evidence, vector<int>(), m_heuristic);
+		for (size_t i = 0; i < order.size(); ++i)
+		{
+			if (wanted[order[i]]) max_order.push_back(order[i]);
+		}
+		vector<Factor> buckets;
+		for (size_t i = 0; i < max_order.size(); ++i)
+		{
+			buckets.push_back(eliminate(factors, max_order[i], true));
+		}
+
+		Factor result;
+		for (size_t f = 0; f < factors.size(); ++f)
+		{
+			result = result.product(factors[f]);
+		}
+		if (result.get_values()[0] <= 0.0)
+			throw runtime_error("Evidence has zero probability");
+
+		// every other node in a bucket was maxed out later, so it is already
+		// set by the time the bucket is read back
+		Assignment returnval = evidence;
+		for (int i = max_order.size() - 1; i >= 0; --i)
+		{
+			int id = max_order[i];
+			Factor bucket = buckets[i];
+			vector<int> variables = bucket.get_variables();
+			for (size_t v = 0; v < variables.size(); ++v)
+			{
+				if (variables[v] != id)
+					bucket = bucket.reduce(variables[v], returnval[variables[v]]);
+			}
+			const vector<double>& values = bucket.get_values();
+			returnval[id] = std::max_element(values.begin(), values.end()) - values.begin();
+		}
+		return returnval;
+	}
+
+
+	// Applies the evidence to every table.
+	vector<Factor> VariableElimination::get_factors(const Assignment& evidence) const
+	{
+		vector<Factor> factors;
+		for (int node = 0; node < m_model.num_nodes(); ++node)
+		{
+			Factor factor = m_model.get_factor(node);
+			vector<int> variables = factor.get_variables();
+			for (size_t v = 0; v < variables.size(); ++v)
+			{
+				if (evidence[variables[v]] != STATE_UNSET)
+					factor = factor.reduce(variables[v], evidence[variables[v]]);
+			}
+			factors.push_back(factor);
+		}
+		return factors;
+	}
+
+
+	// Multiplies together every factor that mentions the node, replaces them
+	// with the product summed or maxed over the node, and returns the product.
+	Factor VariableElimination::eliminate(vector<Factor>& factors, int id,
+	                                      bool maximize) const
+	{
+		bool rescale = m_model.is_log_domain();
+		Factor bucket;
+		size_t f = 0;
+		while (f < factors.size())
+		{
+			if (factors[f].has_variable(id))
+			{
+				bucket = bucket.product(factors[f]);
+				if (rescale) bucket.normalize();
+				factors[f] = factors.back();
+				factors.pop_back();
+			}
+			else ++f;
+		}
+		factors.push_back(maximize ? bucket.max_out(id) : bucket.sum_out(id));
+		return bucket;
+	}
+
+}
@@ -20,6 +20,10 @@
  */
 
 #include <math.h>
+#include <string.h>
+#include <stdint.h>
+#include <fstream>
+#include <sstream>
 #include "sbn.h"
 
 using namespace sbn;
@@ -130,8 +134,565 @@ int main(int argc, char **argv)
 	}
 
 	// verify that results are correct
-	if (round(result["T"] * 10) == 9.0 && round(result["F"] * 10) == 1.0)
-		return 0; // success
+	bool success = true;
+	if (round(result["T"] * 10) != 9.0 || round(result["F"] * 10) != 1.0)
+		success = false;
+
+	// and so should several chains run in parallel
+	net.set_num_chains(4);
+	result = net.query_node("GrassWet");
+	if (fabs(result["T"] - 0.9) > 0.1) success = false;
+
+	// the same seed must reproduce the same estimate
+	StateProbabilityMap replay;
+	net.set_seed(42);
+	result = net.query_node("GrassWet");
+	net.set_seed(42);
+	replay = net.query_node("GrassWet");
+	if (result != replay) success = false;
+
+	// burn-in and thinning don't change what the chain converges to, and a
+	// time limit still leaves an estimate
+	QueryOptions options;
+	options.num_samples = 2000;
+	options.burn_in = 100;
+	options.thinning = 2;
+	result = net.query_node("GrassWet", options);
+	if (fabs(result["T"] - 0.9) > 0.1) success = false;
+	options.num_samples = 100000000;
+	options.time_limit = 0.002;
+	result = net.query_node("GrassWet", options);
+	if (fabs(result["T"] + result["F"] - 1.0) > 1e-9) success = false;
+
+	// one run answers for every node
+	NodeProbabilityMap marginals = net.query_all_nodes();
+	if (marginals.size() != 4) success = false;
+	if (fabs(marginals["GrassWet"]["T"] - 0.9) > 0.1) success = false;
+	if (fabs(marginals["Rain"]["T"] - 1.0) > 1e-9) success = false;
+
+	// so should the forward samplers, within sampling error (rejection
+	// sampling keeps only the few samples that match the evidence)
+	net.set_inference_mode(INFERENCE_MODE_REJECTION_SAMPLING);
+	result = net.query_node("GrassWet");
+	if (fabs(result["T"] - 0.9) > 0.2) success = false;
+	net.set_inference_mode(INFERENCE_MODE_LIKELIHOOD_WEIGHTING);
+	result = net.query_node("GrassWet");
+	if (fabs(result["T"] - 0.9) > 0.1) success = false;
+
+	// exact inference should give the table entry itself
+	net.set_inference_mode(INFERENCE_MODE_EXACT);
+	result = net.query_node("GrassWet");
+	cout << "Exact posterior of GrassWet = T given " << e << " is " <<
+		result["T"] << endl;
+	if (fabs(result["T"] - 0.9) > 1e-9) success = false;
+
+	// and sum out the unobserved nodes when the evidence is further away
+	e.clear();
+	e.set_node("GrassWet", "T");
+	net.set_evidence(e);
+	result = net.query_node("Rain");
+	cout << "Exact posterior of Rain = T given " << e << " is " <<
+		result["T"] << endl;
+	if (fabs(result["T"] - 0.6950578338590957) > 1e-9) success = false;
+
+	// a calibrated junction tree answers the same queries
+	net.set_inference_mode(INFERENCE_MODE_JUNCTION_TREE);
+	result = net.query_node("Rain");
+	if (fabs(result["T"] - 0.6950578338590957) > 1e-9) success = false;
+	result = net.query_node("GrassWet");
+	if (fabs(result["T"] - 1.0) > 1e-9) success = false;
+
+	// a batch of evidence sets gives the same answers as one query at a time
+	shared_ptr<const CompiledNet> model = net.compile();
+	EvidenceBatch batch;
+	batch.nodes.push_back(model->get_node_id("GrassWet"));
+	batch.nodes.push_back(model->get_node_id("Sprinkler"));
+	batch.columns.resize(2);
+	batch.columns[0].push_back(model->get_state_index(batch.nodes[0], "T"));
+	batch.columns[1].push_back(STATE_UNSET);
+	batch.columns[0].push_back(STATE_UNSET);
+	batch.columns[1].push_back(model->get_state_index(batch.nodes[1], "F"));
+	vector< vector< vector<double> > > batch_result =
+		net.query_batch(batch, vector<string>(1, "Rain"));
+	int rain_true = model->get_state_index(model->get_node_id("Rain"), "T");
+	e.clear();
+	e.set_node("Sprinkler", "F");
+	net.set_evidence(e);
+	result = net.query_node("Rain");
+	if (batch_result.size() != 2 ||
+	    fabs(batch_result[0][0][rain_true] - 0.6950578338590957) > 1e-9 ||
+	    fabs(batch_result[1][0][rain_true] - result["T"]) > 1e-9)
+		success = false;
+
+	// contexts let several threads query the same network at once
+	e.clear();
+	e.set_node("GrassWet", "T");
+	net.set_evidence(e);
+	vector<QueryContext> contexts(4, net.new_context());
+	vector<double> answers(contexts.size());
+	vector<std::thread> threads;
+	for (size_t t = 0; t < contexts.size(); ++t)
+	{
+		threads.push_back(std::thread([&contexts, &answers, t]() {
+			answers[t] = contexts[t].query_node("Rain")["T"];
+		}));
+	}
+	for (size_t t = 0; t < threads.size(); ++t) threads[t].join();
+	for (size_t t = 0; t < answers.size(); ++t)
+	{
+		if (fabs(answers[t] - 0.6950578338590957) > 1e-9) success = false;
+	}
+
+	// cached answers are reused until the network changes
+	net.set_cache_size(16);
+	result = net.query_node("Rain");
+	vector<double> rain_table = rain.get_probabilities();
+	rain.set_probabilities(vector<double>(rain_table.size(), 0.5));
+	replay = net.query_node("Rain");
+	if (fabs(replay["T"] - result["T"]) < 1e-3) success = false;
+	rain.set_probabilities(rain_table);
+	net.set_inference_mode(INFERENCE_MODE_MARKOV_CHAIN_MONTE_CARLO);
+	result = net.query_node("Rain");
+	replay = net.query_node("Rain");
+	if (result != replay) success = false;
+	net.set_cache_size(0);
+
+	// assigning a node never lowers its revision, so edits elsewhere can't
+	// bring the network back to the revision it was compiled at
+	Net revisions;
+	Node first_node("First"), second_node("Second");
+	first_node.add_state("lo");
+	first_node.add_state("hi");
+	second_node.add_state("lo");
+	second_node.add_state("hi");
+	revisions.add_node(&first_node);
+	revisions.add_node(&second_node);
+	first_node.add_child(&second_node);
+	first_node.set_probabilities(vector<double>{ 0.5, 0.5 });
+	Node first_copy = first_node;
+	for (int edit = 0; edit < 4; ++edit)
+		first_node.set_probabilities(vector<double>{ 0.5, 0.5 });
+	second_node.set_probabilities(vector<double>{ 0.9, 0.9, 0.1, 0.1 });
+	revisions.set_inference_mode(INFERENCE_MODE_EXACT);
+	double second_low = revisions.query_node("Second")["lo"];
+	first_node = first_copy;
+	for (int edit = 0; edit < 2; ++edit)
+		second_node.set_probabilities(vector<double>{ 0.2, 0.2, 0.8, 0.8 });
+	if (fabs(revisions.query_node("Second")["lo"] - second_low) < 0.5)
+		success = false;
+
+	// a table set in one piece is remapped, not lost, when the structure
+	// changes afterwards
+	Node season("Season"), lawn("Lawn"), hose("Hose");
+	season.add_state("summer");
+	lawn.add_state("green");
+	lawn.add_state("brown");
+	hose.add_state("on");
+	hose.add_state("off");
+	season.add_child(&lawn);
+	lawn.set_probabilities(vector<double>{ 0.8, 0.2 });
+	season.add_state("winter");
+	Event winter;
+	winter.set_node("Season", "winter");
+	winter.set_node("Lawn", "green");
+	lawn.set_probability(winter, 0.1);
+	winter.set_node("Lawn", "brown");
+	lawn.set_probability(winter, 0.9);
+	Event incomplete_event;
+	incomplete_event.set_node("Lawn", "green");
+	try
+	{
+		lawn.set_probability(incomplete_event, 0.5);
+		success = false;
+	}
+	catch (runtime_error&)
+	{
+	}
+	lawn.add_parent(&hose);
+	double remapped[] = { 0.8, 0.8, 0.1, 0.1, 0.2, 0.2, 0.9, 0.9 };
+	if (lawn.get_probabilities() != vector<double>(remapped, remapped + 8))
+		success = false;
+	lawn.remove_parent(&season);
+	double summer[] = { 0.8, 0.8, 0.2, 0.2 };
+	if (lawn.get_probabilities() != vector<double>(summer, summer + 4))
+		success = false;
+
+	// findings can be added and retracted one at a time
+	e.clear();
+	net.set_evidence(e);
+	net.set_inference_mode(INFERENCE_MODE_JUNCTION_TREE);
+	StateProbabilityMap prior = net.query_node("Rain");
+	net.add_evidence("GrassWet", "T");
+	result = net.query_node("Rain");
+	if (fabs(result["T"] - 0.6950578338590957) > 1e-9) success = false;
+	net.retract_evidence("GrassWet");
+	result = net.query_node("Rain");
+	if (fabs(result["T"] - prior["T"]) > 1e-9) success = false;
+	net.set_inference_mode(INFERENCE_MODE_MARKOV_CHAIN_MONTE_CARLO);
+	net.add_evidence("Sprinkler", "F");
+	net.add_evidence("Rain", "T");
+	result = net.query_node("GrassWet");
+	if (fabs(result["T"] - 0.9) > 0.1) success = false;
+
+	// with both of its parents observed, GrassWet doesn't depend on Cloudy
+	Assignment observed(model->num_nodes(), STATE_UNSET);
+	observed[model->get_node_id("Rain")] = 0;
+	observed[model->get_node_id("Sprinkler")] = 0;
+	vector<bool> tables, observations;
+	model->get_requisite_nodes(vector<int>(1, model->get_node_id("GrassWet")),
+	                           observed, tables, observations);
+	int cloudy_id = model->get_node_id("Cloudy");
+	if (tables[cloudy_id] || observations[cloudy_id] ||
+	    !tables[model->get_node_id("GrassWet")] ||
+	    !observations[model->get_node_id("Rain")])
+		success = false;
+
+	// events compare by content, however they were built
+	Event first, second;
+	first.set_node("Rain", "T");
+	first.set_node("Cloudy", "F");
+	second.set_node("Cloudy", "F");
+	second.set_node("Sprinkler", "T");
+	second.set_node("Rain", "T");
+	second.remove_node("Sprinkler");
+	if (!(first == second) || first.hash() != second.hash() ||
+	    string(first) != string(second))
+		success = false;
+
+	// every instruction set computes the same tables, up to rounding
+	vector<double> a(37), b(37), expected(37), actual(37);
+	for (size_t i = 0; i < a.size(); ++i)
+	{
+		a[i] = (i % 7) / 7.0;
+		b[i] = (i % 5) / 5.0;
+	}
+	int best = kernels::get_instruction_set();
+	kernels::set_instruction_set(kernels::KERNEL_SCALAR);
+	kernels::divide(&expected[0], &a[0], &b[0], a.size());
+	double total = kernels::sum(&a[0], a.size());
+	vector<double> expected_max = a;
+	kernels::maximum(&expected_max[0], &b[0], a.size());
+	for (int isa = kernels::KERNEL_AVX2; isa <= best; ++isa)
+	{
+		kernels::set_instruction_set(isa);
+		kernels::divide(&actual[0], &a[0], &b[0], a.size());
+		if (actual != expected) success = false;
+		if (fabs(kernels::sum(&a[0], a.size()) - total) > 1e-12) success = false;
+		actual = a;
+		kernels::maximum(&actual[0], &b[0], a.size());
+		if (actual != expected_max) success = false;
+	}
+	kernels::set_instruction_set(best);
+
+	// A source watched by many sensors: the likelihood of the readings is far
+	// below the smallest double, which only the log domain can cope with
+	Net sensors("Sensors");
+	Node source("Source");
+	source.add_state("T");
+	source.add_state("F");
+	sensors.add_node(&source);
+	source.set_probabilities(vector<double>(2, 0.5));
+	vector<Node> readings;
+	readings.reserve(150);
+	Event all_on;
+	for (int i = 0; i < 150; ++i)
+	{
+		readings.push_back(Node("Sensor" + std::to_string(i)));
+		readings[i].add_state("On");
+		readings[i].add_state("Off");
+		sensors.add_node(&readings[i]);
+		source.add_child(&readings[i]);
+		double table[] = { 0.001, 0.002, 0.999, 0.998 };
+		readings[i].set_probabilities(vector<double>(table, table + 4));
+		all_on.set_node(readings[i].get_name(), "On");
+	}
+	sensors.set_evidence(all_on);
+	sensors.set_log_domain(true);
+	sensors.set_precision(PRECISION_FLOAT);
+	sensors.set_seed(3);
+	int sensor_modes[] = { INFERENCE_MODE_EXACT,
+	                       INFERENCE_MODE_JUNCTION_TREE,
+	                       INFERENCE_MODE_LIKELIHOOD_WEIGHTING,
+	                       INFERENCE_MODE_MARKOV_CHAIN_MONTE_CARLO };
+	for (int m = 0; m < 4; ++m)
+	{
+		sensors.set_inference_mode(sensor_modes[m]);
+		if (sensors.query_node("Source")["F"] < 0.99) success = false;
+	}
+
+	// a saved model answers the same queries once it is loaded back in
+	net.save("sbntest.model");
+	QueryContext loaded(CompiledNet::load("sbntest.model"), INFERENCE_MODE_EXACT);
+	Event wet;
+	wet.set_node("GrassWet", "T");
+	loaded.set_evidence(wet);
+	if (fabs(loaded.query_node("Rain")["T"] - 0.6950578338590957) > 1e-9)
+		success = false;
+	sensors.save("sbntest.model");
+	loaded = QueryContext(CompiledNet::load("sbntest.model"), INFERENCE_MODE_EXACT);
+	if (loaded.get_model()->get_precision() != PRECISION_FLOAT ||
+	    !loaded.get_model()->is_log_domain())
+		success = false;
+	loaded.set_evidence(all_on);
+	if (loaded.query_node("Source")["F"] < 0.99) success = false;
+
+	// a file whose child lists don't mirror the parent lists is rejected.
+	// Cause (id 0) lists child 1, and Effect (id 1) lists parent 0, which is
+	// turned into Other (id 2); the nodes can still be ordered, but Cause is
+	// no longer among its child's parents.
+	Net trio("Trio");
+	Node cause("Cause"), effect("Effect"), other("Other");
+	Node *members[] = { &cause, &effect, &other };
+	for (int m = 0; m < 3; ++m)
+	{
+		members[m]->add_state("lo");
+		members[m]->add_state("hi");
+		trio.add_node(members[m]);
+	}
+	cause.add_child(&effect);
+	trio.save("sbntest.model");
+	std::ifstream model_in("sbntest.model", std::ios::binary);
+	string model_file((std::istreambuf_iterator<char>(model_in)),
+	                  std::istreambuf_iterator<char>());
+	model_in.close();
+	size_t links = model_file.find("hi", model_file.find("Other")) + 2;
+	uint32_t wrong_parent = 2;
+	memcpy(&model_file[links + 4 * sizeof(uint32_t)], &wrong_parent,
+	       sizeof(wrong_parent));
+	std::ofstream model_out("sbntest.model", std::ios::binary);
+	model_out << model_file;
+	model_out.close();
+	try
+	{
+		CompiledNet::load("sbntest.model");
+		success = false;
+	}
+	catch (runtime_error&)
+	{
+	}
+	remove("sbntest.model");
+
+	// each file format should reproduce the network it was written from
+	int formats[] = { FORMAT_BIF, FORMAT_XMLBIF, FORMAT_HUGIN };
+	for (int f = 0; f < 3; ++f)
+	{
+		std::stringstream file;
+		net.write(file, formats[f]);
+		Net copy;
+		copy.read(file, formats[f]);
+		QueryContext context(copy.compile(), INFERENCE_MODE_EXACT);
+		context.set_evidence(wet);
+		if (fabs(context.query_node("Rain")["T"] - 0.6950578338590957) > 1e-9)
+			success = false;
+	}
+
+	// titles and names with blanks and punctuation survive every format
+	Net odd("Odd names (v2), {draft}");
+	Node cause_odd("Rain | maybe"), effect_odd("Wet grass, (front)|yard;");
+	cause_odd.add_state("yes, sure");
+	cause_odd.add_state("no");
+	effect_odd.add_state("very wet;");
+	effect_odd.add_state("dry (ish)");
+	odd.add_node(&cause_odd);
+	odd.add_node(&effect_odd);
+	cause_odd.add_child(&effect_odd);
+	cause_odd.set_probabilities(vector<double>{ 0.4, 0.6 });
+	effect_odd.set_probabilities(vector<double>{ 0.9, 0.3, 0.1, 0.7 });
+	odd.set_inference_mode(INFERENCE_MODE_EXACT);
+	double odd_wet = odd.query_node("Wet grass, (front)|yard;")["very wet;"];
+	for (int f = 0; f < 3; ++f)
+	{
+		std::stringstream file;
+		odd.write(file, formats[f]);
+		Net copy;
+		copy.read(file, formats[f]);
+		std::stringstream rewritten;
+		copy.write(rewritten, formats[f]);
+		if (rewritten.str() != file.str()) success = false;
+		copy.set_inference_mode(INFERENCE_MODE_EXACT);
+		if (fabs(copy.query_node("Wet grass, (front)|yard;")["very wet;"] - odd_wet) > 1e-9)
+			success = false;
+	}
+
+	// every node needs exactly one table with all of its rows, though a
+	// default entry may fill in the ones that aren't given
+	string variables_bif =
+		"variable a { type discrete [ 2 ] { x, y }; }\n"
+		"variable b { type discrete [ 2 ] { x, y }; }\n";
+	const char *bad_tables[] = {
+		"probability ( a ) { table 0.5, 0.5; }\n"
+		"probability ( a ) { table 0.1, 0.9; }\n"
+		"probability ( b ) { table 0.5, 0.5; }\n",
+		"probability ( a ) { table 0.5, 0.5; }\n",
+		"probability ( a ) { table 0.5, 0.5; }\n"
+		"probability ( b | a ) { (x) 0.1, 0.9; }\n"
+	};
+	for (int t = 0; t < 3; ++t)
+	{
+		std::stringstream file(variables_bif + bad_tables[t]);
+		Net rejected;
+		try
+		{
+			rejected.read(file, FORMAT_BIF);
+			success = false;
+		}
+		catch (runtime_error&)
+		{
+		}
+	}
+	std::stringstream defaulted(variables_bif +
+		"probability ( a ) { table 0.5, 0.5; }\n"
+		"probability ( b | a ) { (x) 0.1, 0.9; default 0.3, 0.7; }\n");
+	Net accepted;
+	accepted.read(defaulted, FORMAT_BIF);
+
+	// tables learned from data sampled from the network give about the same
+	// posterior as the data itself, and the counts themselves are exact
+	model = net.compile();
+	RandomEngine rng(7);
+	std::stringstream data;
+	std::stringstream partial;
+	data << "Cloudy,Sprinkler,\"Rain\",GrassWet\n";
+	partial << "Cloudy,Sprinkler,Rain,GrassWet\n";
+	int rain_id = model->get_node_id("Rain");
+	int grasswet_id = model->get_node_id("GrassWet");
+	int num_wet = 0, num_rain = 0;
+	for (int r = 0; r < 20000; ++r)
+	{
+		Assignment sample(model->num_nodes(), STATE_UNSET);
+		model->sample_forward(sample, rng);
+		const char *names[] = { "Cloudy", "Sprinkler", "Rain", "GrassWet" };
+		for (int c = 0; c < 4; ++c)
+		{
+			int id = model->get_node_id(names[c]);
+			data << (c ? "," : "") << model->get_state_name(id, sample[id]);
+			partial << (c ? "," : "");
+			if (id != rain_id || r % 3) partial << model->get_state_name(id, sample[id]);
+		}
+		data << (r % 2 ? "\r\n" : "\n");
+		partial << "\n";
+		if (model->get_state_name(grasswet_id, sample[grasswet_id]) != "T") continue;
+		num_wet++;
+		if (model->get_state_name(rain_id, sample[rain_id]) == "T") num_rain++;
+	}
+	std::stringstream structure;
+	net.write(structure, FORMAT_BIF);
+	Net learned;
+	learned.read(structure, FORMAT_BIF);
+	learned.learn_parameters(data, 1);
+	learned.set_inference_mode(INFERENCE_MODE_EXACT);
+	learned.set_evidence(wet);
+	if (fabs(learned.query_node("Rain")["T"] - num_rain / (double)num_wet) > 0.02)
+		success = false;
+
+	// expectation maximization recovers about the same tables when a third of
+	// the rows don't say whether it rained
+	structure.clear();
+	structure.seekg(0);
+	Net fitted;
+	fitted.read(structure, FORMAT_BIF);
+	if (fitted.learn_parameters_em(partial, 1) < 2) success = false;
+	fitted.set_inference_mode(INFERENCE_MODE_EXACT);
+	fitted.set_evidence(wet);
+	if (fabs(fitted.query_node("Rain")["T"] - learned.query_node("Rain")["T"]) > 0.02)
+		success = false;
+
+	// structure learning from the same data links the grass to both of its
+	// causes, and the fitted network answers like the data
+	vector<Node> unlinked;
+	const char *variables[] = { "Cloudy", "Sprinkler", "Rain", "GrassWet" };
+	for (int v = 0; v < 4; ++v)
+	{
+		unlinked.push_back(Node(variables[v]));
+		unlinked.back().add_state("T");
+		unlinked.back().add_state("F");
+	}
+	Net searched;
+	for (int v = 0; v < 4; ++v) searched.add_node(&unlinked[v]);
+	std::stringstream complete(data.str());
+	StructureOptions structure_options;
+	structure_options.tabu_size = 5;
+	searched.learn_structure(complete, 1, structure_options);
+	shared_ptr<const CompiledNet> found = searched.compile();
+	int found_wet = found->get_node_id("GrassWet");
+	for (int v = 1; v < 3; ++v)
+	{
+		int cause = found->get_node_id(variables[v]);
+		const vector<int>& wet_parents = found->get_parents(found_wet);
+		const vector<int>& cause_parents = found->get_parents(cause);
+		if (find(wet_parents.begin(), wet_parents.end(), cause) == wet_parents.end() &&
+		    find(cause_parents.begin(), cause_parents.end(), found_wet) == cause_parents.end())
+			success = false;
+	}
+	searched.set_inference_mode(INFERENCE_MODE_EXACT);
+	searched.set_evidence(wet);
+	if (fabs(searched.query_node("Rain")["T"] - num_rain / (double)num_wet) > 0.02)
+		success = false;
+
+	// a row with a missing value is left out of every family's score, even
+	// the families that don't include the unobserved node
+	EvidenceBatch cloudy_rain;
+	cloudy_rain.nodes.push_back(found->get_node_id("Cloudy"));
+	cloudy_rain.nodes.push_back(found->get_node_id("Rain"));
+	cloudy_rain.columns.resize(2);
+	for (int r = 0; r < 12; ++r)
+	{
+		cloudy_rain.columns[0].push_back(r % 3 == 0);
+		cloudy_rain.columns[1].push_back(r % 2);
+	}
+	EvidenceBatch incomplete = cloudy_rain;
+	incomplete.columns[0].push_back(1);
+	incomplete.columns[1].push_back(STATE_UNSET);
+	StructureLearner cloudy_rain_scores(found, cloudy_rain);
+	StructureLearner incomplete_scores(found, incomplete);
+	if (incomplete_scores.get_score(cloudy_rain.nodes[0], vector<int>()) !=
+	    cloudy_rain_scores.get_score(cloudy_rain.nodes[0], vector<int>()))
+		success = false;
+
+	// the most probable explanation of wet grass beats every other
+	// configuration that agrees with it, and a single node's MAP state is the
+	// most likely state of its marginal
+	net.set_evidence(wet);
+	model = net.compile();
+	Assignment explanation = model->to_assignment(net.query_mpe());
+	double best_probability = 0;
+	Assignment configuration = model->to_assignment(wet);
+	for (int c = 0; c < 8; ++c)
+	{
+		for (int v = 0, bit = 0; v < model->num_nodes(); ++v)
+		{
+			if (v != grasswet_id) configuration[v] = (c >> bit++) & 1;
+		}
+		double probability = 1;
+		for (int v = 0; v < model->num_nodes(); ++v)
+		{
+			probability *= model->get_probability(v, configuration[v], configuration);
+		}
+		best_probability = std::max(best_probability, probability);
+	}
+	double explanation_probability = 1;
+	for (int v = 0; v < model->num_nodes(); ++v)
+	{
+		if (explanation[v] == STATE_UNSET) success = false;
+		else explanation_probability *=
+			model->get_probability(v, explanation[v], explanation);
+	}
+	if (fabs(explanation_probability - best_probability) > 1e-12) success = false;
+	if (net.query_map(vector<string>(1, "Rain")).get_node_state("Rain") != "T")
+		success = false;
+
+	std::stringstream counted("GrassWet, Cloudy\nT,T\n\"T\",T\nF, ?\n,F\n");
+	DataReader reader(counted, model);
+	ParameterLearner learner(model);
+	ThreadPool pool(2);
+	learner.add(reader, pool);
+	vector<double> cloudy_ml = learner.get_table(model->get_node_id("Cloudy"));
+	vector<double> cloudy_map = learner.get_table(model->get_node_id("Cloudy"), 1);
+	if (learner.get_num_rows() != 4 || fabs(cloudy_ml[0] - 2.0 / 3) > 1e-12 ||
+	    fabs(cloudy_map[0] - 3.0 / 5) > 1e-12)
+		success = false;
+
+	if (success) return 0; // success
 	
 	return 1; // failure
 }